@@ -34,11 +34,18 @@
 #include "script_functions.h"
 
 #include "config.h"
+#include "match.h"
 
 /**
  *
  */
 GSList *event_lists[W_NUM_EVENTS] = { NULL, NULL, NULL, NULL, NULL };
+GSList *handler_scripts = NULL;
+double name_change_debounce = 0;
+double name_change_max_rate = 0;
+double focus_settle_time = 0;
+double event_time_slice = 0.02;
+gboolean async_x_errors = FALSE;
 const char *const event_names[W_NUM_EVENTS] = {
 	"window_open",
 	"window_close",
@@ -125,6 +132,23 @@ EXITPOINT:
 }
 
 
+/**
+ *  get_number
+ * Read a numeric global, returning the default if it's unset or not a number
+ */
+static double get_number(lua_State *luastate, const gchar *name, double default_value)
+{
+	double value = default_value;
+
+	lua_getglobal(luastate, name);
+	if (lua_type(luastate, -1) == LUA_TNUMBER)
+		value = lua_tonumber(luastate, -1);
+	lua_pop(luastate, 1);
+
+	return value;
+}
+
+
 /**
  *  is_in_list
  * Go through _one_ list, and check if the filename is in this list
@@ -165,7 +189,7 @@ static gboolean is_in_any_list(gchar *filename)
 			return TRUE;
 	}
 
-	return FALSE;
+	return is_in_list(handler_scripts, filename);
 }
 
 
@@ -218,6 +242,23 @@ int load_config(gchar *filename)
 		event_lists[W_NAME_CHANGED] = get_table_of_strings(config_lua_state,
 		                         script_folder,
 		                         "scripts_window_name_change");
+		handler_scripts = get_table_of_strings(config_lua_state,
+		                         script_folder,
+		                         "scripts_with_handlers");
+
+		set_script_timeouts(get_number(config_lua_state, "script_timeout", 5),
+		                    get_number(config_lua_state, "event_timeout", 0));
+
+		name_change_debounce = get_number(config_lua_state, "name_change_debounce", 0);
+		name_change_max_rate = get_number(config_lua_state, "name_change_max_rate", 0);
+		focus_settle_time = get_number(config_lua_state, "focus_settle_time", 0);
+		event_time_slice = get_number(config_lua_state, "event_time_slice", 0.02);
+
+		lua_getglobal(config_lua_state, "async_x_errors");
+		async_x_errors = lua_toboolean(config_lua_state, -1);
+		lua_pop(config_lua_state, 1);
+
+		read_script_matches(config_lua_state, script_folder);
 	}
 
 	// add the files in the folder to our linked list
@@ -242,6 +283,8 @@ int load_config(gchar *filename)
 	}
 
 	event_lists[W_OPEN] = temp_window_open_file_list;
+
+	build_match_index();
 EXITPOINT:
 	if (config_lua_state)
 		done_script(config_lua_state);
@@ -272,6 +315,8 @@ void clear_file_lists()
 {
 	win_event_type i = 0;
 
+	clear_match_index();
+
 	for (i = 0; i < W_NUM_EVENTS; i++) {
 		if (event_lists[i]) {
 			unallocate_file_list(event_lists[i]);
@@ -279,4 +324,10 @@ void clear_file_lists()
 			event_lists[i] = NULL;
 		}
 	}
+
+	if (handler_scripts) {
+		unallocate_file_list(handler_scripts);
+		g_slist_free(handler_scripts);
+		handler_scripts = NULL;
+	}
 }
@@ -35,6 +35,12 @@ typedef enum {
 } win_event_type;
 
 extern GSList *event_lists[W_NUM_EVENTS];
+extern GSList *handler_scripts;
+extern double name_change_debounce;
+extern double name_change_max_rate;
+extern double focus_settle_time;
+extern double event_time_slice;
+extern gboolean async_x_errors;
 extern const char *const event_names[W_NUM_EVENTS];
 
 // Our git version which is defined through some magic in the build system
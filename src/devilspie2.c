@@ -41,6 +41,10 @@
 #include "error_strings.h"
 
 #include "config.h"
+#include "match.h"
+#include "xutils.h"
+#include "window_index.h"
+#include "timers.h"
 
 
 #if (GTK_MAJOR_VERSION >= 3)
@@ -64,6 +68,7 @@ static gboolean show_lua_version = FALSE;
 
 static gchar *script_folder = NULL;
 static gchar *temp_folder = NULL;
+static gchar *cache_folder = NULL;
 
 GFileMonitor *mon = NULL;
 
@@ -75,53 +80,378 @@ WnckHandle *my_wnck_handle = NULL;
  *
  */
 static void load_list_of_scripts(WnckScreen *screen G_GNUC_UNUSED, WnckWindow *window,
-                                 GSList *file_list)
+                                 win_event_type event)
 {
+	// anything slow to look up is fetched once, for all of the scripts
+	begin_window_snapshot(window);
+	// and window changes are collected, to be sent together afterwards
+	begin_window_changes();
+	// only the scripts whose script_match predicates (if any) hold
+	GSList *file_list = match_scripts(event, window);
 	GSList *temp_file_list = file_list;
 	// set the window to work on
 	set_current_window(window);
 
-	// for every file in the folder - load the script
-	if (event_lists[W_OPEN] != NULL) {
+	script_begin_event();
 
-		while(temp_file_list) {
-			gchar *filename = (gchar*)temp_file_list->data;
+	// for every file in the list - load the script
+	while(temp_file_list) {
+		gchar *filename = (gchar*)temp_file_list->data;
 
-			// is it a Lua file?
-			if (g_str_has_suffix((gchar*)filename, ".lua")) {
+		// is it a Lua file?
+		if (g_str_has_suffix((gchar*)filename, ".lua")) {
 
-				// init the script, run it
-				if (!run_script(global_lua_state, filename))
-					/**/;
+			// init the script, run it
+			if (!run_cached_script(global_lua_state, filename))
+				/**/;
 
-			}
-			temp_file_list=temp_file_list->next;
 		}
+		temp_file_list=temp_file_list->next;
 	}
+	g_slist_free(file_list);
+
+	// then any functions registered by scripts_with_handlers
+	run_script_handlers(global_lua_state, event);
+
+	script_end_event();
+	end_window_snapshot();
+	flush_window_changes();
+
+	// send whatever the scripts asked for in one go
+	XFlush(gdk_x11_get_default_xdisplay());
 	return;
 
 }
 
 
+/**
+ * Per-window name-change state, keyed by XID and dropped when the window
+ * closes. last_name is the name which the scripts last saw.
+ */
+struct name_change_state {
+	WnckWindow *window;
+	gchar *last_name;
+	gint64 last_run;
+	guint timeout_id;
+};
+
+static GHashTable *name_changes = NULL;
+
+
+/**
+ * Pending focus change while focus_settle_time is in effect: the window
+ * which was originally left, and the screen on which to look for the
+ * window which ends up active.
+ */
+static struct {
+	WnckScreen *screen;
+	WnckWindow *left;
+	gboolean blur_pending;
+	guint timeout_id;
+	guint activations;
+} focus_change;
+
+static guint focus_events_dropped = 0;
+static guint blur_events_dropped = 0;
+
+
+/**
+ * Events waiting to be run from the main loop. Focus and blur go first;
+ * opens and name changes can wait, except that a window's focus and blur
+ * wait behind its own open. Each queued event holds a reference to its
+ * window, and is dropped if the window closes first.
+ */
+struct queued_event {
+	win_event_type event;
+	WnckScreen *screen;
+	WnckWindow *window;
+};
+
+static GQueue focus_queue = G_QUEUE_INIT;
+static GQueue other_queue = G_QUEUE_INIT;
+static guint queue_source_id = 0;
+
+
+/**
+ *
+ */
+static void free_queued_event(struct queued_event *queued)
+{
+	if (queued->window)
+		g_object_unref(queued->window);
+	g_free(queued);
+}
+
+
+/**
+ *
+ */
+static GList *find_queued_event(GQueue *queue, WnckWindow *window, win_event_type event)
+{
+	for (GList *link = queue->head; link; link = link->next) {
+		struct queued_event *queued = link->data;
+		if (queued->window == window && queued->event == event)
+			return link;
+	}
+	return NULL;
+}
+
+
+/**
+ * Whether a focus or blur for the window has to wait in other_queue: its
+ * open hasn't been run yet, or an earlier focus or blur is waiting there
+ */
+static gboolean focus_waits_for_open(WnckWindow *window)
+{
+	return find_queued_event(&other_queue, window, W_OPEN) ||
+	       find_queued_event(&other_queue, window, W_FOCUS) ||
+	       find_queued_event(&other_queue, window, W_BLUR);
+}
+
+
+/**
+ * Asks the X server about the PIDs of the queued windows which don't have
+ * _NET_WM_PID all at once, rather than one at a time as scripts ask
+ */
+static void prefetch_queued_pids(void)
+{
+	GQueue *queues[] = { &focus_queue, &other_queue };
+	GArray *xids = g_array_new(FALSE, FALSE, sizeof(Window));
+
+	for (unsigned i = 0; i < G_N_ELEMENTS(queues); i++) {
+		for (GList *link = queues[i]->head; link; link = link->next) {
+			struct queued_event *queued = link->data;
+
+			if (queued->window && wnck_window_get_pid(queued->window) == 0) {
+				Window xid = wnck_window_get_xid(queued->window);
+				g_array_append_val(xids, xid);
+			}
+		}
+	}
+
+	prefetch_client_pids((Window *)xids->data, xids->len);
+	g_array_free(xids, TRUE);
+}
+
+
+/**
+ * Runs queued events until the queue is empty or event_time_slice has
+ * been used up; anything left over waits for the next idle iteration so
+ * that X events (and so new focus changes) are handled in between.
+ */
+static gboolean run_queued_events(gpointer data G_GNUC_UNUSED)
+{
+	gint64 deadline = g_get_monotonic_time() + event_time_slice * G_USEC_PER_SEC;
+
+	prefetch_queued_pids();
+
+	do {
+		struct queued_event *queued = g_queue_pop_head(&focus_queue);
+		if (!queued)
+			queued = g_queue_pop_head(&other_queue);
+		if (!queued)
+			break;
+
+		load_list_of_scripts(queued->screen, queued->window, queued->event);
+		free_queued_event(queued);
+	} while (g_get_monotonic_time() < deadline);
+
+	if (g_queue_is_empty(&focus_queue) && g_queue_is_empty(&other_queue)) {
+		queue_source_id = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+
+/**
+ * Queues an event for the window, or runs it at once if event_time_slice
+ * isn't set. Superseded events are dropped rather than queued.
+ */
+static void queue_event(WnckScreen *screen, WnckWindow *window, win_event_type event)
+{
+	GQueue *queue = &other_queue;
+	GList *link;
+
+	if ((event == W_FOCUS || event == W_BLUR) && !focus_waits_for_open(window))
+		queue = &focus_queue;
+
+	if (event_time_slice <= 0) {
+		load_list_of_scripts(screen, window, event);
+		return;
+	}
+
+	switch (event) {
+	case W_BLUR:
+		// focus then blur, neither yet run: the window was only passing through
+		link = find_queued_event(queue, window, W_FOCUS);
+		if (link) {
+			free_queued_event(link->data);
+			g_queue_delete_link(queue, link);
+			focus_events_dropped++;
+			blur_events_dropped++;
+			return;
+		}
+		break;
+	case W_NAME_CHANGED:
+		// the scripts will see the latest name anyway
+		if (find_queued_event(queue, window, W_NAME_CHANGED))
+			return;
+		break;
+	default:
+		break;
+	}
+
+	struct queued_event *queued = g_new(struct queued_event, 1);
+	queued->event = event;
+	queued->screen = screen;
+	queued->window = window ? g_object_ref(window) : NULL;
+	g_queue_push_tail(queue, queued);
+
+	if (!queue_source_id)
+		queue_source_id = g_idle_add(run_queued_events, NULL);
+}
+
+
+/**
+ * Drops any queued events for a window which is closing
+ */
+static void drop_queued_events(WnckWindow *window)
+{
+	GQueue *queues[] = { &focus_queue, &other_queue };
+
+	for (unsigned i = 0; i < G_N_ELEMENTS(queues); i++) {
+		GList *link = queues[i]->head;
+		while (link) {
+			GList *next = link->next;
+			struct queued_event *queued = link->data;
+			if (queued->window == window) {
+				free_queued_event(queued);
+				g_queue_delete_link(queues[i], link);
+			}
+			link = next;
+		}
+	}
+}
+
+
+/**
+ *
+ */
+static void clear_queued_events(void)
+{
+	struct queued_event *queued;
+
+	while ((queued = g_queue_pop_head(&focus_queue)))
+		free_queued_event(queued);
+	while ((queued = g_queue_pop_head(&other_queue)))
+		free_queued_event(queued);
+	if (queue_source_id)
+		g_source_remove(queue_source_id);
+	queue_source_id = 0;
+}
+
+
+/**
+ *
+ */
+static void free_name_change_state(gpointer data)
+{
+	struct name_change_state *state = data;
+
+	if (state->timeout_id)
+		g_source_remove(state->timeout_id);
+	g_free(state->last_name);
+	g_free(state);
+}
+
+
+/**
+ *
+ */
+static struct name_change_state *get_name_change_state(WnckWindow *window)
+{
+	gpointer xid = GSIZE_TO_POINTER(wnck_window_get_xid(window));
+	struct name_change_state *state;
+
+	if (!name_changes)
+		name_changes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+		                                     NULL, free_name_change_state);
+
+	state = g_hash_table_lookup(name_changes, xid);
+	if (!state) {
+		state = g_new0(struct name_change_state, 1);
+		state->window = window;
+		g_hash_table_insert(name_changes, xid, state);
+	}
+
+	return state;
+}
+
+
+/**
+ * Runs the name-change scripts if the name differs from the one which
+ * they last saw
+ */
+static void run_name_change_scripts(struct name_change_state *state)
+{
+	const char *newname = wnck_window_get_name(state->window);
+
+	if (state->last_name && newname && !strcmp(state->last_name, newname))
+		return;
+
+	g_free(state->last_name);
+	state->last_name = g_strdup(newname);
+	state->last_run = g_get_monotonic_time();
+
+	queue_event(wnck_window_get_screen(state->window), state->window, W_NAME_CHANGED);
+}
+
+
+/**
+ *
+ */
+static gboolean name_change_timeout_cb(gpointer data)
+{
+	struct name_change_state *state = data;
+
+	state->timeout_id = 0;
+	run_name_change_scripts(state);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/**
+ * Titles which change rapidly (terminal prompts, progress counters) are
+ * settled for name_change_debounce seconds and limited to
+ * name_change_max_rate runs per second, per window; the scripts only see
+ * the latest name.
+ */
 static void window_name_changed_cb(WnckWindow *window)
 {
 	WnckScreen * screen = wnck_window_get_screen(window);
 	if(screen == NULL) return;
 
-	// Handle duplicate name-change events
-	// Simple method: just track the most recent event regardless of window
-	static WnckWindow *previous = NULL;
-	static char *prevname = NULL;
+	struct name_change_state *state = get_name_change_state(window);
+	gint64 delay = name_change_debounce * G_USEC_PER_SEC;
 
-	const char *newname = wnck_window_get_name(window);
-	if (window == previous && prevname && !strcmp (prevname, newname))
-		return;
-	// Store the info for the next event
-	free(prevname);
-	prevname = strdup(newname);
-	previous = window;
+	if (name_change_max_rate > 0) {
+		gint64 next_run = state->last_run + G_USEC_PER_SEC / name_change_max_rate;
+		delay = MAX(delay, next_run - g_get_monotonic_time());
+	}
+
+	if (state->timeout_id) {
+		g_source_remove(state->timeout_id);
+		state->timeout_id = 0;
+	}
 
-	load_list_of_scripts(screen, window, event_lists[W_NAME_CHANGED]);
+	if (delay <= 0)
+		run_name_change_scripts(state);
+	else
+		state->timeout_id = g_timeout_add(delay / 1000 ? delay / 1000 : 1,
+		                                  name_change_timeout_cb, state);
 }
 
 /**
@@ -129,7 +459,13 @@ static void window_name_changed_cb(WnckWindow *window)
  */
 static void window_opened_cb(WnckScreen *screen, WnckWindow *window)
 {
-	load_list_of_scripts(screen, window, event_lists[W_OPEN]);
+	watch_window_properties(wnck_window_get_xid(window));
+	window_index_add(window);
+	queue_event(screen, window, W_OPEN);
+
+	// the open scripts have seen this name; don't report it as a change
+	struct name_change_state *state = get_name_change_state(window);
+	state->last_name = g_strdup(wnck_window_get_name(window));
 	/*
 	Attach a listener to each window for window-specific changes
 	Safe to do this way as long as the 'user data' parameter is NULL
@@ -143,7 +479,61 @@ static void window_opened_cb(WnckScreen *screen, WnckWindow *window)
  */
 static void window_closed_cb(WnckScreen *screen, WnckWindow *window)
 {
-	load_list_of_scripts(screen, window, event_lists[W_CLOSE]);
+	// anything still queued for this window is stale; the close is run now
+	drop_queued_events(window);
+	// the window is going, so close scripts can't wait for anything
+	script_begin_no_wait();
+	load_list_of_scripts(screen, window, W_CLOSE);
+	script_end_no_wait();
+	forget_window_properties(wnck_window_get_xid(window));
+	window_index_remove(window);
+	script_window_closed(window);
+	cancel_window_timers(window);
+	forget_client_window(wnck_window_get_xid(window));
+
+	if (name_changes)
+		g_hash_table_remove(name_changes, GSIZE_TO_POINTER(wnck_window_get_xid(window)));
+
+	// a window which has gone can't be blurred
+	if (focus_change.timeout_id && focus_change.left == window) {
+		focus_change.left = NULL;
+		focus_change.blur_pending = FALSE;
+	}
+}
+
+
+/**
+ *
+ */
+static gboolean focus_settled_cb(gpointer data G_GNUC_UNUSED)
+{
+	WnckWindow *cur = wnck_screen_get_active_window(focus_change.screen);
+
+	focus_change.timeout_id = 0;
+
+	// each collapsed activation would have been a focus and a blur
+	focus_events_dropped += focus_change.activations - 1;
+	blur_events_dropped += focus_change.activations - 1;
+
+	if (focus_change.blur_pending && cur == focus_change.left) {
+		// back where we started; nothing to report
+		focus_events_dropped++;
+		blur_events_dropped++;
+	} else {
+		if (focus_change.blur_pending)
+			queue_event(focus_change.screen, focus_change.left, W_BLUR);
+		else
+			blur_events_dropped++;
+		queue_event(focus_change.screen, cur, W_FOCUS);
+	}
+
+	if (debug && (focus_change.activations > 1))
+		printf(_("Focus settled after %u activations (dropped so far: %u focus, %u blur)\n"),
+		       focus_change.activations, focus_events_dropped, blur_events_dropped);
+
+	focus_change.activations = 0;
+
+	return G_SOURCE_REMOVE;
 }
 
 
@@ -154,9 +544,24 @@ static void window_changed_cb(WnckScreen *screen, WnckWindow *window)
 {
 	WnckWindow *cur;
 
-	load_list_of_scripts(screen, window, event_lists[W_BLUR]);
+	if (focus_settle_time > 0) {
+		// collapse rapid changes (alt-tab cycling) into one blur & focus
+		if (focus_change.timeout_id) {
+			g_source_remove(focus_change.timeout_id);
+		} else {
+			focus_change.screen = screen;
+			focus_change.left = window;
+			focus_change.blur_pending = TRUE;
+		}
+		focus_change.activations++;
+		focus_change.timeout_id = g_timeout_add(MAX(focus_settle_time * 1000, 1),
+		                                        focus_settled_cb, NULL);
+		return;
+	}
+
+	queue_event(screen, window, W_BLUR);
 	cur = wnck_screen_get_active_window(screen);
-	load_list_of_scripts(screen, cur, event_lists[W_FOCUS]);
+	queue_event(screen, cur, W_FOCUS);
 }
 
 
@@ -193,7 +598,17 @@ void init_screens()
 void devilspie_exit()
 {
 	clear_file_lists();
+	if (debug && (focus_events_dropped || blur_events_dropped))
+		printf(_("Dropped %u focus and %u blur events\n"),
+		       focus_events_dropped, blur_events_dropped);
+	if (focus_change.timeout_id)
+		g_source_remove(focus_change.timeout_id);
+	clear_queued_events();
+	if (name_changes)
+		g_hash_table_destroy(name_changes);
 	g_free(temp_folder);
+	g_free(cache_folder);
+	set_bytecode_cache_folder(NULL);
 	if (mon)
 		g_object_unref(mon);
 	g_free(config_filename);
@@ -249,6 +664,9 @@ void print_script_lists()
 	if (debug)
 		printf("------------\n");
 
+	if (handler_scripts)
+		have_any_files = TRUE;
+
 	for (i = 0; i < W_NUM_EVENTS; i++) {
 		if (event_lists[i])
 			have_any_files = TRUE;
@@ -263,6 +681,11 @@ void print_script_lists()
 		}
 	}
 
+	if (debug && handler_scripts) {
+		printf("%s\n", _("List of Lua files with event handlers in folder:"));
+		print_list(handler_scripts);
+	}
+
 	if (!have_any_files) {
 		printf("%s\n\n", _("No script files found in the script folder - exiting."));
 		exit(EXIT_SUCCESS);
@@ -280,6 +703,22 @@ void folder_changed_callback(GFileMonitor *mon G_GNUC_UNUSED,
                              gpointer user_data)
 {
 	gchar *our_filename = (gchar*)(user_data);
+	gboolean reload_handlers = FALSE;
+
+	// Whatever happened to the file, any compiled copy of it is now stale
+	if (first_file) {
+		gchar *folder = g_path_get_dirname(our_filename);
+		gchar *short_filename = g_file_get_basename(first_file);
+		gchar *filename = g_build_path(G_DIR_SEPARATOR_S, folder, short_filename, NULL);
+
+		script_cache_invalidate(filename);
+		if (g_slist_find_custom(handler_scripts, filename, (GCompareFunc)g_strcmp0))
+			reload_handlers = TRUE;
+
+		g_free(filename);
+		g_free(short_filename);
+		g_free(folder);
+	}
 
 	// If a file is created or deleted, we need to check the file lists again
 	if ((event == G_FILE_MONITOR_EVENT_CREATED) ||
@@ -289,6 +728,7 @@ void folder_changed_callback(GFileMonitor *mon G_GNUC_UNUSED,
 
 		set_current_window(NULL);
 		load_config(our_filename);
+		reload_handlers = TRUE;
 
 		if (debug)
 			printf("Files in folder updated!\n - new lists:\n\n");
@@ -311,14 +751,21 @@ void folder_changed_callback(GFileMonitor *mon G_GNUC_UNUSED,
 
 				set_current_window(NULL);
 				load_config(our_filename);
+				reload_handlers = TRUE;
 
 				print_script_lists();
 
 				if (debug)
 					printf("----------");
 			}
+			g_free(short_filename);
 		}
 	}
+
+	if (reload_handlers) {
+		set_current_window(NULL);
+		load_script_handlers(global_lua_state, handler_scripts);
+	}
 }
 
 
@@ -337,6 +784,9 @@ int main(int argc, char *argv[])
 		{ "folder",       'f', 0, G_OPTION_ARG_STRING, &script_folder,
 		  N_("Search for scripts in this folder"), N_("FOLDER")
 		},
+		{ "cache-folder", 'c', 0, G_OPTION_ARG_STRING, &cache_folder,
+		  N_("Keep compiled scripts in this folder (\"\" to disable)"), N_("FOLDER")
+		},
 		{ "version",      'v', 0, G_OPTION_ARG_NONE,   &show_version,
 		  N_("Show Devilspie2 version and quit"), NULL
 		},
@@ -445,6 +895,15 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	// if no cache folder is given, default to ~/.cache/devilspie2/
+	if (cache_folder == NULL) {
+		cache_folder = g_build_path(G_DIR_SEPARATOR_S,
+		                            g_get_user_cache_dir(),
+		                            "devilspie2",
+		                            NULL);
+	}
+	set_bytecode_cache_folder(cache_folder);
+
 	// set the current window to NULL, we don't need to be able to modify
 	// the windows when reading the config
 	set_current_window(NULL);
@@ -491,6 +950,7 @@ int main(int argc, char *argv[])
 
 	global_lua_state = init_script();
 	print_script_lists();
+	load_script_handlers(global_lua_state, handler_scripts);
 
 	if (debug) printf("------------\n");
 
@@ -35,11 +35,13 @@ gchar *at_least_four_indata_expected_error = NULL;
 gchar *number_expected_as_indata_error = NULL;
 gchar *boolean_expected_as_indata_error = NULL;
 gchar *string_expected_as_indata_error = NULL;
+gchar *table_expected_as_indata_error = NULL;
 
 gchar *number_or_string_expected_as_indata_error = NULL;
 gchar *number_or_string_or_boolean_expected_as_indata_error = NULL;
 
 gchar *integer_greater_than_zero_expected_error = NULL;
+gchar *non_negative_integer_expected_error = NULL;
 gchar *could_not_find_current_viewport_error = NULL;
 
 gchar *setting_viewport_failed_error = NULL;
@@ -74,11 +76,13 @@ int init_script_error_messages()
 	INIT_ERRMSG(number_expected_as_indata_error,            _("Number expected as parameter"));
 	INIT_ERRMSG(boolean_expected_as_indata_error,           _("Boolean expected as parameter"));
 	INIT_ERRMSG(string_expected_as_indata_error,            _("String expected as parameter"));
+	INIT_ERRMSG(table_expected_as_indata_error,             _("Table expected as parameter"));
 
 	INIT_ERRMSG(number_or_string_expected_as_indata_error,  _("Number or string expected as parameter"));
 	INIT_ERRMSG(number_or_string_or_boolean_expected_as_indata_error,  _("Number or string or boolean expected as parameter"));
 
 	INIT_ERRMSG(integer_greater_than_zero_expected_error,   _("Integer greater than zero expected"));
+	INIT_ERRMSG(non_negative_integer_expected_error,        _("Non-negative integer expected"));
 	INIT_ERRMSG(could_not_find_current_viewport_error,      _("Could not find current viewport"));
 	INIT_ERRMSG(setting_viewport_failed_error,              _("Setting viewport failed"));
 
@@ -105,11 +109,13 @@ void done_script_error_messages()
 	g_free(number_expected_as_indata_error);
 	g_free(boolean_expected_as_indata_error);
 	g_free(string_expected_as_indata_error);
+	g_free(table_expected_as_indata_error);
 
 	g_free(number_or_string_expected_as_indata_error);
 	g_free(number_or_string_or_boolean_expected_as_indata_error);
 
 	g_free(integer_greater_than_zero_expected_error);
+	g_free(non_negative_integer_expected_error);
 	g_free(could_not_find_current_viewport_error);
 	g_free(setting_viewport_failed_error);
 
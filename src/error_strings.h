@@ -34,11 +34,13 @@ extern gchar *at_least_four_indata_expected_error;
 extern gchar *number_expected_as_indata_error;
 extern gchar *boolean_expected_as_indata_error;
 extern gchar *string_expected_as_indata_error;
+extern gchar *table_expected_as_indata_error;
 
 extern gchar *number_or_string_expected_as_indata_error;
 extern gchar *number_or_string_or_boolean_expected_as_indata_error;
 
 extern gchar *integer_greater_than_zero_expected_error;
+extern gchar *non_negative_integer_expected_error;
 extern gchar *could_not_find_current_viewport_error;
 
 extern gchar *setting_viewport_failed_error;
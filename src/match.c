@@ -0,0 +1,411 @@
+/**
+ *	This file is part of devilspie2
+ *	Copyright (C) 2026 devilspie2 developers
+ *
+ *	devilspie2 is free software: you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as published
+ *	by the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	devilspie2 is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with devilspie2.
+ *	If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+#include <string.h>
+
+#define WNCK_I_KNOW_THIS_IS_UNSTABLE
+#include <libwnck/libwnck.h>
+
+#include <X11/Xlib.h>
+#include <gdk/gdk.h>
+
+#include <glib/gi18n.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#if (GTK_MAJOR_VERSION >= 3)
+#define HAVE_GTK3
+#endif
+
+#include "script_functions.h"
+#include "xutils.h"
+
+#include "match.h"
+
+
+/**
+ * Predicates for one script, from script_match in devilspie2.lua.
+ * A NULL field is unconstrained; a list matches if any entry does,
+ * and all of the constrained fields must match.
+ */
+struct script_match {
+	gchar **classes;
+	gchar **instances;
+	gchar **roles;
+	gchar **types;
+	gchar **processes;
+	GSList *name_globs;   /* GPatternSpec * */
+	GSList *name_regexes; /* GRegex * */
+};
+
+/**
+ * One script in one event list. The filename belongs to event_lists[];
+ * order is its position there, so that candidates can be merged back into
+ * the order in which the scripts would have run without the index.
+ */
+struct match_entry {
+	const gchar *filename;
+	guint order;
+	const struct script_match *match;
+};
+
+/**
+ * Scripts with a class predicate are reachable only through by_class;
+ * everything else has to be looked at for every window.
+ */
+struct match_index {
+	GHashTable *by_class;
+	GSList *unindexed;
+	GSList *entries;
+};
+
+/**
+ * The role needs a round trip to the X server, so it's only fetched once
+ * per dispatch, and only if some script asks. (The process name is kept
+ * in the event's window snapshot.)
+ */
+struct window_info {
+	WnckWindow *window;
+	gboolean have_role;
+	gchar *role;
+};
+
+static GHashTable *script_matches = NULL;
+static struct match_index indices[W_NUM_EVENTS];
+static gboolean index_built = FALSE;
+
+
+/**
+ * Reads a string or a table of strings from the top of the Lua stack
+ */
+static gchar **get_strings(lua_State *lua)
+{
+	GPtrArray *list = g_ptr_array_new();
+
+	if (lua_type(lua, -1) == LUA_TSTRING) {
+		g_ptr_array_add(list, g_strdup(lua_tostring(lua, -1)));
+	} else if (lua_istable(lua, -1)) {
+		lua_pushnil(lua);
+		while (lua_next(lua, -2)) {
+			if (lua_type(lua, -1) == LUA_TSTRING)
+				g_ptr_array_add(list, g_strdup(lua_tostring(lua, -1)));
+			lua_pop(lua, 1);
+		}
+	}
+
+	g_ptr_array_add(list, NULL);
+	return (gchar **)g_ptr_array_free(list, FALSE);
+}
+
+
+/**
+ *
+ */
+static void free_script_match(gpointer data)
+{
+	struct script_match *match = data;
+
+	g_strfreev(match->classes);
+	g_strfreev(match->instances);
+	g_strfreev(match->roles);
+	g_strfreev(match->types);
+	g_strfreev(match->processes);
+	g_slist_free_full(match->name_globs, (GDestroyNotify)g_pattern_spec_free);
+	g_slist_free_full(match->name_regexes, (GDestroyNotify)g_regex_unref);
+	g_free(match);
+}
+
+
+/**
+ * Parses the predicate table on the top of the Lua stack
+ */
+static struct script_match *parse_script_match(lua_State *lua, const gchar *script)
+{
+	struct script_match *match = g_new0(struct script_match, 1);
+
+	lua_pushnil(lua);
+	while (lua_next(lua, -2)) {
+		const char *key = lua_type(lua, -2) == LUA_TSTRING ? lua_tostring(lua, -2) : "";
+
+		if (!strcmp(key, "class")) {
+			match->classes = get_strings(lua);
+		} else if (!strcmp(key, "instance")) {
+			match->instances = get_strings(lua);
+		} else if (!strcmp(key, "role")) {
+			match->roles = get_strings(lua);
+		} else if (!strcmp(key, "type")) {
+			match->types = get_strings(lua);
+		} else if (!strcmp(key, "process")) {
+			match->processes = get_strings(lua);
+		} else if (!strcmp(key, "name")) {
+			gchar **globs = get_strings(lua);
+			for (int i = 0; globs[i]; i++)
+				match->name_globs = g_slist_append(match->name_globs, g_pattern_spec_new(globs[i]));
+			g_strfreev(globs);
+		} else if (!strcmp(key, "name_regex")) {
+			gchar **patterns = get_strings(lua);
+			for (int i = 0; patterns[i]; i++) {
+				GError *error = NULL;
+				GRegex *regex = g_regex_new(patterns[i], G_REGEX_OPTIMIZE, 0, &error);
+				if (regex) {
+					match->name_regexes = g_slist_append(match->name_regexes, regex);
+				} else {
+					printf(_("script_match: bad name_regex for %s: %s\n"), script, error->message);
+					g_error_free(error);
+				}
+			}
+			g_strfreev(patterns);
+		} else {
+			printf(_("script_match: ignoring unknown key \"%s\" for %s\n"), key, script);
+		}
+
+		lua_pop(lua, 1);
+	}
+
+	return match;
+}
+
+
+/**
+ * Reads script_match from the config state; the keys are script names
+ * relative to the script folder.
+ */
+void read_script_matches(lua_State *lua, const gchar *script_folder)
+{
+	if (!script_matches)
+		script_matches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_script_match);
+
+	lua_getglobal(lua, "script_match");
+
+	if (lua_istable(lua, -1)) {
+		lua_pushnil(lua);
+		while (lua_next(lua, -2)) {
+			if (lua_type(lua, -2) == LUA_TSTRING && lua_istable(lua, -1)) {
+				const char *script = lua_tostring(lua, -2);
+				gchar *filename = g_build_path(G_DIR_SEPARATOR_S, script_folder, script, NULL);
+				g_hash_table_replace(script_matches, filename, parse_script_match(lua, script));
+			} else {
+				printf("%s\n", _("script_match: entries must be script = { ... }"));
+			}
+			lua_pop(lua, 1);
+		}
+	}
+
+	lua_pop(lua, 1);
+}
+
+
+/**
+ * Builds the per-event index from event_lists[] and the predicates read
+ * by read_script_matches. Must be rebuilt whenever event_lists[] changes.
+ */
+void build_match_index(void)
+{
+	for (win_event_type event = 0; event < W_NUM_EVENTS; event++) {
+		struct match_index *index = &indices[event];
+		guint order = 0;
+
+		index->by_class = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+		                                        (GDestroyNotify)g_slist_free);
+
+		for (GSList *list = event_lists[event]; list; list = list->next) {
+			struct match_entry *entry = g_new(struct match_entry, 1);
+
+			entry->filename = list->data;
+			entry->order = order++;
+			entry->match = script_matches ? g_hash_table_lookup(script_matches, entry->filename) : NULL;
+			index->entries = g_slist_prepend(index->entries, entry);
+
+			if (entry->match && entry->match->classes) {
+				for (int i = 0; entry->match->classes[i]; i++) {
+					const gchar *class = entry->match->classes[i];
+					GSList *bucket = g_hash_table_lookup(index->by_class, class);
+					// a class listed twice mustn't run the script twice
+					if (g_slist_find(bucket, entry))
+						continue;
+					// steal so that replacing the value doesn't free the list
+					g_hash_table_steal(index->by_class, class);
+					g_hash_table_insert(index->by_class, (gpointer)class,
+					                    g_slist_append(bucket, entry));
+				}
+			} else {
+				index->unindexed = g_slist_append(index->unindexed, entry);
+			}
+		}
+	}
+
+	index_built = TRUE;
+}
+
+
+/**
+ *
+ */
+void clear_match_index(void)
+{
+	for (win_event_type event = 0; event < W_NUM_EVENTS; event++) {
+		struct match_index *index = &indices[event];
+
+		if (index->by_class)
+			g_hash_table_destroy(index->by_class);
+		g_slist_free(index->unindexed);
+		g_slist_free_full(index->entries, g_free);
+		index->by_class = NULL;
+		index->unindexed = NULL;
+		index->entries = NULL;
+	}
+
+	if (script_matches)
+		g_hash_table_remove_all(script_matches);
+
+	index_built = FALSE;
+}
+
+
+/**
+ *
+ */
+static gboolean in_list(gchar *const *list, const char *value)
+{
+	if (!value)
+		value = "";
+
+	for (; *list; list++)
+		if (!strcmp(*list, value))
+			return TRUE;
+
+	return FALSE;
+}
+
+
+/**
+ * The cheap, client-side attributes are checked first.
+ */
+static gboolean window_matches(const struct script_match *match, struct window_info *info)
+{
+	WnckWindow *window = info->window;
+
+	if (!window)
+		return FALSE;
+
+	if (match->types && !in_list(match->types, get_window_type_name(window)))
+		return FALSE;
+
+	if (match->classes && !in_list(match->classes, get_window_class_name(window)))
+		return FALSE;
+
+	if (match->instances) {
+#ifdef HAVE_GTK3
+		if (!in_list(match->instances, wnck_window_get_class_instance_name(window)))
+			return FALSE;
+#else
+		return FALSE;
+#endif
+	}
+
+	if (match->name_globs || match->name_regexes) {
+		const char *name = wnck_window_get_name(window);
+		gboolean found = !match->name_globs;
+
+		if (!name)
+			name = "";
+
+		for (GSList *glob = match->name_globs; glob && !found; glob = glob->next)
+#if GLIB_CHECK_VERSION(2, 70, 0)
+			found = g_pattern_spec_match_string(glob->data, name);
+#else
+			found = g_pattern_match_string(glob->data, name);
+#endif
+		if (!found)
+			return FALSE;
+
+		found = !match->name_regexes;
+		for (GSList *regex = match->name_regexes; regex && !found; regex = regex->next)
+			found = g_regex_match(regex->data, name, 0, NULL);
+		if (!found)
+			return FALSE;
+	}
+
+	if (match->roles) {
+		if (!info->have_role) {
+			info->role = my_wnck_get_string_property(wnck_window_get_xid(window),
+			                                         my_wnck_atom_get("WM_WINDOW_ROLE"), NULL);
+			info->have_role = TRUE;
+		}
+		if (!in_list(match->roles, info->role))
+			return FALSE;
+	}
+
+	if (match->processes) {
+		gchar *process = get_window_process_name(window);
+		gboolean found = in_list(match->processes, process);
+
+		g_free(process);
+		if (!found)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Returns the scripts to run for this event and window, in the order in
+ * which they appear in event_lists[event]. Free with g_slist_free; the
+ * filenames are not copied.
+ */
+GSList *match_scripts(win_event_type event, WnckWindow *window)
+{
+	if (!index_built)
+		return g_slist_copy(event_lists[event]);
+
+	struct match_index *index = &indices[event];
+	struct window_info info = { window, FALSE, NULL };
+	GSList *unindexed = index->unindexed;
+	GSList *indexed = NULL;
+	GSList *result = NULL;
+
+	if (window) {
+		const char *class = get_window_class_name(window);
+		indexed = g_hash_table_lookup(index->by_class, class ? class : "");
+	}
+
+	while (unindexed || indexed) {
+		struct match_entry *entry;
+
+		if (!indexed || (unindexed &&
+		                 ((struct match_entry *)unindexed->data)->order <
+		                 ((struct match_entry *)indexed->data)->order)) {
+			entry = unindexed->data;
+			unindexed = unindexed->next;
+		} else {
+			entry = indexed->data;
+			indexed = indexed->next;
+		}
+
+		if (!entry->match || window_matches(entry->match, &info))
+			result = g_slist_prepend(result, (gpointer)entry->filename);
+	}
+
+	g_free(info.role);
+
+	return g_slist_reverse(result);
+}
@@ -0,0 +1,355 @@
+/**
+ *	This file is part of devilspie2
+ *	Copyright (C) 2026 devilspie2 developers
+ *
+ *	devilspie2 is free software: you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as published
+ *	by the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	devilspie2 is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with devilspie2.
+ *	If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pwd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "process_info.h"
+
+
+/**
+ * What's known about one process. The name, start time and owner are read
+ * when the process is first asked about; the executable and the command
+ * line only if they're asked for.
+ */
+struct process_info {
+	pid_t pid;
+	unsigned long long start_time;
+	gchar *name;
+	uid_t uid;
+	gboolean have_uid;
+	gboolean have_exe, have_cmdline;
+	gchar *exe;
+	gchar **cmdline;
+	int pidfd;      /* -1 if there's no pidfd for this process */
+	guint watch_id;
+};
+
+static GHashTable *processes = NULL; /* pid → struct process_info */
+static gboolean pidfd_unsupported = FALSE;
+
+/**
+ * User names, as looked up with getpwuid(), which may have to ask a
+ * directory server. Users who can't be found are remembered too, for less
+ * time.
+ */
+struct user_name {
+	gchar *name;    /* NULL if there's no such user */
+	gint64 expires; /* monotonic time, or 0 for never */
+};
+
+#define USER_NAME_TTL     (10 * 60 * G_USEC_PER_SEC)
+#define NO_USER_NAME_TTL  (60 * G_USEC_PER_SEC)
+
+static GHashTable *user_names = NULL; /* uid → struct user_name */
+
+
+/**
+ *
+ */
+static void free_process_info(gpointer data)
+{
+	struct process_info *info = data;
+
+	if (info->watch_id)
+		g_source_remove(info->watch_id);
+	if (info->pidfd >= 0)
+		close(info->pidfd);
+	g_free(info->name);
+	g_free(info->exe);
+	g_strfreev(info->cmdline);
+	g_free(info);
+}
+
+
+/**
+ * Returns a pidfd for the process, or -1 if there isn't one (if the
+ * process has gone, or the kernel is older than 5.3, or this isn't Linux)
+ */
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	if (!pidfd_unsupported) {
+		int pidfd = syscall(SYS_pidfd_open, pid, 0);
+
+		if (pidfd < 0 && errno == ENOSYS)
+			pidfd_unsupported = TRUE;
+		return pidfd;
+	}
+#endif
+	return -1;
+}
+
+
+/**
+ * The pidfd becomes readable when the process exits
+ */
+static gboolean process_exited_cb(gint fd G_GNUC_UNUSED, GIOCondition condition G_GNUC_UNUSED,
+                                  gpointer pid)
+{
+	struct process_info *info = g_hash_table_lookup(processes, pid);
+
+	if (info) {
+		info->watch_id = 0; // removed by returning FALSE
+		g_hash_table_remove(processes, pid);
+	}
+
+	return FALSE;
+}
+
+
+/**
+ * Reads the name and start time from /proc/<pid>/stat. The name is in
+ * parentheses and may itself contain spaces and parentheses, so the
+ * fields after it are found from the last ')'.
+ */
+static gboolean read_process_stat(pid_t pid, unsigned long long *start_time, gchar **name)
+{
+	gchar *path = g_strdup_printf("/proc/%lu/stat", (unsigned long)pid);
+	gchar *contents = NULL;
+	gboolean ok = FALSE;
+
+	if (g_file_get_contents(path, &contents, NULL, NULL)) {
+		char *open = strchr(contents, '(');
+		char *close = strrchr(contents, ')');
+
+		if (open && close && close > open) {
+			// after the name: state (field 3) ... starttime (field 22)
+			gchar **fields = g_strsplit(close + 2, " ", 21);
+
+			if (g_strv_length(fields) > 19) {
+				*start_time = g_ascii_strtoull(fields[19], NULL, 10);
+				*name = g_strndup(open + 1, close - open - 1);
+				ok = TRUE;
+			}
+			g_strfreev(fields);
+		}
+	}
+
+	g_free(contents);
+	g_free(path);
+	return ok;
+}
+
+
+/**
+ * Returns what's known about the process, or NULL if it has gone (or
+ * there's no /proc). If the process has a pidfd, its entry is dropped when
+ * it exits; otherwise the start time is checked every time, in case the
+ * PID has been reused.
+ */
+static struct process_info *lookup_process(pid_t pid)
+{
+	struct process_info *info;
+	unsigned long long start_time;
+	gchar *name;
+	int pidfd;
+
+	if (pid <= 0)
+		return NULL;
+
+	if (!processes)
+		processes = g_hash_table_new_full(NULL, NULL, NULL, free_process_info);
+
+	info = g_hash_table_lookup(processes, GINT_TO_POINTER(pid));
+	if (info && info->pidfd >= 0)
+		return info;
+
+	// open the pidfd first, so that what's read is for the process it refers to
+	pidfd = open_pidfd(pid);
+
+	if (!read_process_stat(pid, &start_time, &name)) {
+		if (pidfd >= 0)
+			close(pidfd);
+		g_hash_table_remove(processes, GINT_TO_POINTER(pid));
+		return NULL;
+	}
+
+	if (info && info->start_time == start_time) {
+		g_free(name);
+		if (pidfd >= 0)
+			close(pidfd);
+		return info;
+	}
+
+	info = g_new0(struct process_info, 1);
+	info->pid = pid;
+	info->start_time = start_time;
+	info->name = name;
+	info->pidfd = pidfd;
+	if (pidfd >= 0)
+		info->watch_id = g_unix_fd_add(pidfd, G_IO_IN, process_exited_cb, GINT_TO_POINTER(pid));
+
+	gchar *path = g_strdup_printf("/proc/%lu", (unsigned long)pid);
+	struct stat st;
+	if (stat(path, &st) == 0) {
+		info->uid = st.st_uid;
+		info->have_uid = TRUE;
+	}
+	g_free(path);
+
+	g_hash_table_replace(processes, GINT_TO_POINTER(pid), info);
+	return info;
+}
+
+
+/**
+ * Returns the process name (as in /proc/<pid>/comm), or NULL if not known
+ */
+gchar *get_process_info_name(pid_t pid)
+{
+	struct process_info *info = lookup_process(pid);
+
+	return info ? g_strdup(info->name) : NULL;
+}
+
+
+/**
+ * Returns the path of the process's executable, or NULL if not known (as
+ * for other users' processes)
+ */
+gchar *get_process_info_exe(pid_t pid)
+{
+	struct process_info *info = lookup_process(pid);
+
+	if (!info)
+		return NULL;
+
+	if (!info->have_exe) {
+		gchar *path = g_strdup_printf("/proc/%lu/exe", (unsigned long)pid);
+		info->exe = g_file_read_link(path, NULL);
+		info->have_exe = TRUE;
+		g_free(path);
+	}
+
+	return g_strdup(info->exe);
+}
+
+
+/**
+ * Returns the process's arguments, or NULL if not known. Free with
+ * g_strfreev.
+ */
+gchar **get_process_info_cmdline(pid_t pid)
+{
+	struct process_info *info = lookup_process(pid);
+
+	if (!info)
+		return NULL;
+
+	if (!info->have_cmdline) {
+		gchar *path = g_strdup_printf("/proc/%lu/cmdline", (unsigned long)pid);
+		gchar *contents;
+		gsize length;
+
+		if (g_file_get_contents(path, &contents, &length, NULL)) {
+			GPtrArray *args = g_ptr_array_new();
+
+			// NUL-separated (and usually NUL-terminated)
+			for (gsize i = 0; i < length; i += strlen(contents + i) + 1)
+				g_ptr_array_add(args, g_strdup(contents + i));
+			g_ptr_array_add(args, NULL);
+
+			info->cmdline = (gchar **)g_ptr_array_free(args, FALSE);
+			g_free(contents);
+		}
+		info->have_cmdline = TRUE;
+		g_free(path);
+	}
+
+	return g_strdupv(info->cmdline);
+}
+
+
+/**
+ * Gets the UID which the process is running as; FALSE if not known
+ */
+gboolean get_process_info_uid(pid_t pid, uid_t *uid)
+{
+	struct process_info *info = lookup_process(pid);
+
+	if (!info || !info->have_uid)
+		return FALSE;
+
+	*uid = info->uid;
+	return TRUE;
+}
+
+
+/**
+ *
+ */
+static void free_user_name(gpointer data)
+{
+	struct user_name *user = data;
+
+	g_free(user->name);
+	g_free(user);
+}
+
+
+/**
+ *
+ */
+static void cache_user_name(uid_t uid, const gchar *name, gint64 expires)
+{
+	struct user_name *user = g_new(struct user_name, 1);
+
+	user->name = g_strdup(name);
+	user->expires = expires;
+	g_hash_table_replace(user_names, GUINT_TO_POINTER(uid), user);
+}
+
+
+/**
+ * Returns the name of the user, or NULL if there's no such user. Names
+ * are kept for a while, so that the name service isn't asked on every
+ * call; our own user's name (which glib has already looked up) is known
+ * from the start and kept for good.
+ */
+gchar *get_user_name(uid_t uid)
+{
+	gint64 now = g_get_monotonic_time();
+	struct user_name *user;
+
+	if (!user_names) {
+		user_names = g_hash_table_new_full(NULL, NULL, NULL, free_user_name);
+		cache_user_name(getuid(), g_get_user_name(), 0);
+	}
+
+	user = g_hash_table_lookup(user_names, GUINT_TO_POINTER(uid));
+	if (!user || (user->expires && user->expires <= now)) {
+		struct passwd *pw = getpwuid(uid);
+
+		cache_user_name(uid, pw ? pw->pw_name : NULL,
+		                now + (pw ? USER_NAME_TTL : NO_USER_NAME_TTL));
+		user = g_hash_table_lookup(user_names, GUINT_TO_POINTER(uid));
+	}
+
+	return g_strdup(user->name);
+}
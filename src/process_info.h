@@ -0,0 +1,36 @@
+/**
+ *	This file is part of devilspie2
+ *	Copyright (C) 2026 devilspie2 developers
+ *
+ *	devilspie2 is free software: you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as published
+ *	by the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	devilspie2 is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with devilspie2.
+ *	If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HEADER_PROCESS_INFO_
+#define __HEADER_PROCESS_INFO_
+
+#include <sys/types.h>
+
+#include "compat.h"
+
+/**
+ *
+ */
+ATTR_MALLOC gchar *get_process_info_name(pid_t pid);
+ATTR_MALLOC gchar *get_process_info_exe(pid_t pid);
+ATTR_MALLOC gchar **get_process_info_cmdline(pid_t pid);
+gboolean get_process_info_uid(pid_t pid, uid_t *uid);
+
+ATTR_MALLOC gchar *get_user_name(uid_t uid);
+
+#endif /*__HEADER_PROCESS_INFO_*/
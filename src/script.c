@@ -25,12 +25,20 @@
 #include <glib.h>
 
 #include <gdk/gdk.h>
+#include <gdk/gdkx.h>
+#include <X11/Xlib.h>
 
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
 
 #include <locale.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "compat.h"
 #include "intl.h"
@@ -41,7 +49,31 @@
 #endif
 
 #include "script_functions.h"
-
+#include "window_object.h"
+#include "window_index.h"
+#include "timers.h"
+#include "xutils.h"
+#include "config.h"
+
+#if LUA_VERSION_NUM < 502
+#define luaL_loadbufferx(lua, buf, size, name, mode) luaL_loadbuffer(lua, buf, size, name)
+#endif
+#if LUA_VERSION_NUM < 503
+#define dump_function(lua, writer, data) lua_dump(lua, writer, data)
+#else
+#define dump_function(lua, writer, data) lua_dump(lua, writer, data, 0)
+#endif
+#if LUA_VERSION_NUM < 502
+#define resume_thread(thread, from, nargs) lua_resume(thread, nargs)
+#elif LUA_VERSION_NUM < 504
+#define resume_thread(thread, from, nargs) lua_resume(thread, from, nargs)
+#else
+static int resume_thread(lua_State *thread, lua_State *from, int nargs)
+{
+	int nresults;
+	return lua_resume(thread, from, nargs, &nresults);
+}
+#endif
 
 
 /**
@@ -160,6 +192,7 @@ register_cfunctions(lua_State *lua)
 	DP2_REGISTER(lua, get_window_property);
 	DP2_REGISTER(lua, window_property_is_utf8);
 	DP2_REGISTER(lua, get_window_property_full);
+	DP2_REGISTER(lua, get_window_properties);
 	DP2_REGISTER(lua, get_window_role);
 	DP2_REGISTER(lua, get_window_xid);
 
@@ -198,13 +231,38 @@ register_cfunctions(lua_State *lua)
 	DP2_REGISTER(lua, xy);
 	DP2_REGISTER(lua, xywh);
 
+	DP2_REGISTER(lua, begin_layout);
+	DP2_REGISTER(lua, commit_layout);
+
 	DP2_REGISTER(lua, on_geometry_changed);
 
+	DP2_REGISTER(lua, on_window_open);
+	DP2_REGISTER(lua, on_window_close);
+	DP2_REGISTER(lua, on_focus);
+	DP2_REGISTER(lua, on_blur);
+	DP2_REGISTER(lua, on_name_change);
+
 	DP2_REGISTER(lua, get_process_name);
 
 	DP2_REGISTER(lua, get_process_owner);
+	DP2_REGISTER(lua, get_process_uid);
+	DP2_REGISTER(lua, get_process_exe);
+	DP2_REGISTER(lua, get_process_cmdline);
+
+	DP2_REGISTER(lua, get_window_info);
 
+	DP2_REGISTER(lua, sleep);
 	DP2_REGISTER(lua, millisleep);
+	DP2_REGISTER(lua, wait_for_property);
+	DP2_REGISTER(lua, wait_for_mapped);
+
+	DP2_REGISTER(lua, after);
+	DP2_REGISTER(lua, every);
+	DP2_REGISTER(lua, cancel_timer);
+
+	DP2_REGISTER(lua, find_windows);
+
+	register_window_object(lua);
 }
 
 
@@ -256,25 +314,95 @@ static ATTR_MALLOC gchar *error_add_location(lua_State* lua, const char *msg)
 	return g_strdup_printf("%s:%d: %s", state.short_src, state.currentline, msg);
 }
 
-static gboolean timedout = FALSE;
+/**
+ * Script watchdog
+ * A single interval timer is armed while a script runs. Only when it fires
+ * is a (sparse) count hook installed, so scripts which finish in time run
+ * without any per-instruction overhead.
+ */
+#define SCRIPT_TIMEOUT_HOOK_COUNT 10000
 
-static void timeout_script(int sig)
-{
-	timedout = TRUE;
-}
+static gint64 script_time_limit = 5 * G_USEC_PER_SEC;
+static gint64 event_time_limit = 0; // no limit
+static gint64 event_deadline = 0;
+
+static lua_State *volatile watched_lua = NULL;
+static gboolean registering_handlers = FALSE;
 
-static void check_timeout_script(lua_State *lua, lua_Debug *state)
+static void check_timeout_script(lua_State *lua, lua_Debug *state G_GNUC_UNUSED)
 {
-	// state is invalid?
-	if (!timedout)
-		return;
+	gboolean event_expired = event_deadline && g_get_monotonic_time() >= event_deadline;
+
 	// don't add backtrace etc. here; just the location
-	gchar *msg = error_add_location(lua, _("script timed out"));
+	gchar *msg = error_add_location(lua, event_expired
+	                                     ? _("event time budget exhausted")
+	                                     : _("script timed out"));
 	lua_pushstring(lua, msg);
 	g_free(msg);
 	lua_error(lua);
 }
 
+static void timeout_script(int sig G_GNUC_UNUSED)
+{
+	// lua_sethook is safe to call from a signal handler
+	if (watched_lua)
+		lua_sethook(watched_lua, check_timeout_script, LUA_MASKCOUNT, SCRIPT_TIMEOUT_HOOK_COUNT);
+}
+
+static void set_watchdog(gint64 usec)
+{
+	static gboolean installed = FALSE;
+
+	if (!installed) {
+		struct sigaction newact;
+		newact.sa_handler = timeout_script;
+		sigemptyset(&newact.sa_mask);
+		newact.sa_flags = SA_RESTART;
+		sigaction(SIGALRM, &newact, NULL);
+		installed = TRUE;
+	}
+
+	struct itimerval timer = {
+		{ 0, 0 },
+		{ usec / G_USEC_PER_SEC, usec % G_USEC_PER_SEC }
+	};
+	setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+
+/**
+ * Set the per-script time limit and the total time allowed per event
+ * (in seconds; 0 means no limit for the latter)
+ */
+void set_script_timeouts(double script_seconds, double event_seconds)
+{
+	script_time_limit = script_seconds > 0 ? script_seconds * G_USEC_PER_SEC : 5 * G_USEC_PER_SEC;
+	event_time_limit = event_seconds > 0 ? event_seconds * G_USEC_PER_SEC : 0;
+}
+
+
+/**
+ * Mark the start & end of the scripts being run for one event
+ */
+void script_begin_event(void)
+{
+	event_deadline = event_time_limit ? g_get_monotonic_time() + event_time_limit : 0;
+}
+
+void script_end_event(void)
+{
+	event_deadline = 0;
+}
+
+
+/**
+ * Has the current event used up its time?
+ */
+gboolean script_event_expired(void)
+{
+	return event_deadline && g_get_monotonic_time() >= event_deadline;
+}
+
 static int script_error(lua_State *lua)
 {
 	const char *msg = lua_tostring(lua, -1);
@@ -287,21 +415,663 @@ static int script_error(lua_State *lua)
 }
 
 
+/**
+ * On-disk bytecode cache
+ * Compiled scripts are stored in the cache folder, named by a hash of the
+ * Lua version, the chunk name (which the bytecode records, for error
+ * messages) and the script source, so that other instances (and later
+ * runs) can map them read-only instead of compiling the source again.
+ */
+static gchar *bytecode_folder = NULL;
+
+void set_bytecode_cache_folder(const gchar *folder)
+{
+	g_free(bytecode_folder);
+	bytecode_folder = NULL;
+
+	if (folder && *folder) {
+		if (g_mkdir_with_parents(folder, 0755) == 0)
+			bytecode_folder = g_strdup(folder);
+		else if (devilspie2_debug)
+			printf(_("Couldn't create the bytecode cache folder %s\n"), folder);
+	}
+}
+
+static ATTR_MALLOC gchar *bytecode_filename(const char *chunkname,
+                                            const gchar *source, gsize length)
+{
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+	g_checksum_update(checksum, (const guchar *)LUA_VERSION, sizeof(LUA_VERSION));
+	g_checksum_update(checksum, (const guchar *)chunkname, strlen(chunkname) + 1);
+	g_checksum_update(checksum, (const guchar *)source, length);
+
+	gchar *name = g_strconcat(g_checksum_get_string(checksum), ".luac", NULL);
+	gchar *filename = g_build_filename(bytecode_folder, name, NULL);
+
+	g_free(name);
+	g_checksum_free(checksum);
+	return filename;
+}
+
+/**
+ * Load cached bytecode, if present and trustworthy.
+ * It must be a regular file owned by us, by root or by the owner of the
+ * cache folder, and writable by nobody else.
+ */
+static gboolean load_bytecode(lua_State *lua, const gchar *cachename, const char *chunkname)
+{
+	struct stat folder_info, info;
+	gboolean loaded = FALSE;
+
+	if (stat(bytecode_folder, &folder_info) < 0)
+		return FALSE;
+
+	int fd = open(cachename, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return FALSE;
+
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+	    !(info.st_mode & (S_IWGRP | S_IWOTH)) &&
+	    (info.st_uid == getuid() || info.st_uid == 0 || info.st_uid == folder_info.st_uid)) {
+		GMappedFile *map = g_mapped_file_new_from_fd(fd, FALSE, NULL);
+
+		if (map) {
+			const gchar *code = g_mapped_file_get_contents(map);
+			gsize length = g_mapped_file_get_length(map);
+
+			if (length > strlen(LUA_SIGNATURE) &&
+			    !memcmp(code, LUA_SIGNATURE, strlen(LUA_SIGNATURE))) {
+				if (luaL_loadbufferx(lua, code, length, chunkname, "b") == 0)
+					loaded = TRUE;
+				else
+					lua_pop(lua, 1); // the error message; we'll recompile
+			}
+			g_mapped_file_unref(map);
+		}
+	}
+
+	close(fd);
+	return loaded;
+}
+
+static int bytecode_writer(lua_State *lua G_GNUC_UNUSED, const void *p, size_t size, void *data)
+{
+	g_byte_array_append(data, p, size);
+	return 0;
+}
+
+static void save_bytecode(lua_State *lua, const gchar *cachename)
+{
+	GByteArray *code = g_byte_array_new();
+
+	if (dump_function(lua, bytecode_writer, code) == 0 &&
+	    !g_file_set_contents(cachename, (const gchar *)code->data, code->len, NULL) &&
+	    devilspie2_debug)
+		printf(_("Couldn't write %s\n"), cachename);
+
+	g_byte_array_free(code, TRUE);
+}
+
+
+/**
+ * Load a script, using the bytecode cache if it is enabled.
+ * Return values are as for luaL_loadfile.
+ */
+static int load_script_file(lua_State *lua, const char *filename)
+{
+	if (!bytecode_folder)
+		return luaL_loadfile(lua, filename);
+
+	gchar *source;
+	gsize length;
+
+	if (!g_file_get_contents(filename, &source, &length, NULL))
+		return luaL_loadfile(lua, filename); // for the error message
+
+	gchar *chunkname = g_strconcat("@", filename, NULL);
+	gchar *cachename = bytecode_filename(chunkname, source, length);
+	int result = 0;
+
+	if (!load_bytecode(lua, cachename, chunkname)) {
+		// as luaL_loadfile, skip any UTF-8 BOM then any initial '#' line
+		const gchar *text = source;
+		if (length >= 3 && !memcmp(text, "\xEF\xBB\xBF", 3))
+			text += 3;
+		if (*text == '#')
+			while (*text && *text != '\n')
+				++text;
+
+		result = luaL_loadbufferx(lua, text, length - (text - source), chunkname, NULL);
+		if (result == 0)
+			save_bytecode(lua, cachename);
+	}
+
+	g_free(cachename);
+	g_free(chunkname);
+	g_free(source);
+	return result;
+}
+
+
+/**
+ * Compiled script cache
+ * Each script run via run_cached_script() is compiled once; the resulting
+ * function is kept in the Lua registry and reused for as long as the file's
+ * device, inode, size and modification time are unchanged.
+ */
+struct script_chunk {
+	lua_State *lua;
+	int ref;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
+static GHashTable *script_chunks = NULL;
+
+static void free_script_chunk(gpointer data)
+{
+	struct script_chunk *chunk = data;
+
+	luaL_unref(chunk->lua, LUA_REGISTRYINDEX, chunk->ref);
+	g_free(chunk);
+}
+
+static gboolean script_chunk_is_current(const struct script_chunk *chunk,
+                                        lua_State *lua, const struct stat *info)
+{
+	return chunk->lua == lua &&
+	       chunk->dev == info->st_dev &&
+	       chunk->ino == info->st_ino &&
+	       chunk->size == info->st_size &&
+	       chunk->mtime.tv_sec == info->st_mtim.tv_sec &&
+	       chunk->mtime.tv_nsec == info->st_mtim.tv_nsec;
+}
+
+
+/**
+ * Push the compiled script, loading it if it isn't cached or has changed.
+ * Return values are as for luaL_loadfile.
+ */
+static int load_cached_script(lua_State *lua, const char *filename)
+{
+	struct stat info;
+
+	if (!script_chunks)
+		script_chunks = g_hash_table_new_full(g_str_hash, g_str_equal,
+		                                      g_free, free_script_chunk);
+
+	if (stat(filename, &info) < 0) {
+		g_hash_table_remove(script_chunks, filename);
+		return luaL_loadfile(lua, filename); // for the error message
+	}
+
+	struct script_chunk *chunk = g_hash_table_lookup(script_chunks, filename);
+	if (chunk && script_chunk_is_current(chunk, lua, &info)) {
+		lua_rawgeti(lua, LUA_REGISTRYINDEX, chunk->ref);
+		return 0;
+	}
+
+	int result = load_script_file(lua, filename);
+	if (result) {
+		g_hash_table_remove(script_chunks, filename);
+		return result;
+	}
+
+	chunk = g_new(struct script_chunk, 1);
+	chunk->lua = lua;
+	chunk->dev = info.st_dev;
+	chunk->ino = info.st_ino;
+	chunk->size = info.st_size;
+	chunk->mtime = info.st_mtim;
+	lua_pushvalue(lua, -1);
+	chunk->ref = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+	g_hash_table_replace(script_chunks, g_strdup(filename), chunk);
+	return 0;
+}
+
+
+/**
+ * Forget the compiled version of a script, e.g. because it has been modified
+ */
+void script_cache_invalidate(const char *filename)
+{
+	if (script_chunks)
+		g_hash_table_remove(script_chunks, filename);
+}
+
+
+static gboolean script_chunk_uses_state(gpointer key G_GNUC_UNUSED,
+                                        gpointer value, gpointer lua)
+{
+	return ((struct script_chunk *)value)->lua == lua;
+}
+
+
+/**
+ * Where the running script is (for error messages): the script name, the
+ * line and the function which it is calling; NULL if no script is running
+ */
+gchar *get_script_location(void)
+{
+	lua_State *lua = watched_lua;
+	lua_Debug ar;
+	const char *func = NULL;
+
+	if (!lua)
+		return NULL;
+
+	if (lua_getstack(lua, 0, &ar) && lua_getinfo(lua, "n", &ar))
+		func = ar.name;
+
+	for (int level = 0; lua_getstack(lua, level, &ar); ++level) {
+		lua_getinfo(lua, "Sl", &ar);
+		if (ar.currentline > 0)
+			return func ? g_strdup_printf("%s:%d: %s", ar.short_src, ar.currentline, func)
+			            : g_strdup_printf("%s:%d", ar.short_src, ar.currentline);
+	}
+
+	return func ? g_strdup(func) : NULL;
+}
+
+
+/**
+ * How long the script may run before the watchdog stops it
+ */
+static gint64 get_script_time_limit(void)
+{
+	gint64 limit = script_time_limit;
+
+	if (event_deadline) {
+		gint64 remaining = event_deadline - g_get_monotonic_time();
+		if (remaining < limit)
+			limit = remaining > 0 ? remaining : 1;
+	}
+
+	return limit;
+}
+
+
+/**
+ * Event scripts run as coroutines, so that sleep() and the wait_for_…()
+ * functions can hand control back to the main loop instead of blocking
+ * it. A suspended script is resumed, with its window as the current one,
+ * when the timeout expires or when the X event which it's waiting for
+ * arrives; other events are handled in the meantime.
+ */
+struct script_thread {
+	lua_State *lua;       /* the main state */
+	lua_State *thread;
+	int ref;              /* keeps the thread from being collected */
+	WnckWindow *window;   /* the current window when the script started */
+	script_wait_type waiting;
+	Window xid;
+	Atom atom;
+	guint timeout_id;
+	guint wake_id;
+};
+
+static GList *waiting_threads = NULL;
+static struct script_thread *running_thread = NULL;
+static gboolean watching_wait_events = FALSE;
+
+
+/**
+ *
+ */
+static void stop_waiting(struct script_thread *st)
+{
+	if (st->timeout_id)
+		g_source_remove(st->timeout_id);
+	if (st->wake_id)
+		g_source_remove(st->wake_id);
+	st->timeout_id = 0;
+	st->wake_id = 0;
+	st->waiting = SCRIPT_WAIT_NONE;
+	waiting_threads = g_list_remove(waiting_threads, st);
+}
+
+
+/**
+ *
+ */
+static void free_script_thread(struct script_thread *st)
+{
+	stop_waiting(st);
+	luaL_unref(st->lua, LUA_REGISTRYINDEX, st->ref);
+	g_free(st);
+}
+
+
+/**
+ * Run (or carry on running) the script until it finishes or waits
+ */
+static void resume_script_thread(struct script_thread *st, int nargs)
+{
+	struct script_thread *previous = running_thread;
+
+	running_thread = st;
+	watched_lua = st->thread;
+	set_watchdog(get_script_time_limit());
+
+	int s = resume_thread(st->thread, st->lua, nargs);
+
+	set_watchdog(0);
+	watched_lua = NULL;
+	lua_sethook(st->thread, NULL, 0, 0);
+	running_thread = previous;
+
+	// the function which yielded has arranged for the script to be woken
+	if (s == LUA_YIELD && st->waiting != SCRIPT_WAIT_NONE)
+		return;
+
+	if (s == LUA_YIELD) {
+		printf(_("Error: %s\n"), _("scripts may only yield by waiting"));
+	} else if (s) {
+		const char *msg = lua_tostring(st->thread, -1);
+		gchar *fullmsg = error_add_backtrace(st->thread, msg ? msg : "?");
+		printf(_("Error: %s\n"), fullmsg);
+		g_free(fullmsg);
+	}
+
+	free_script_thread(st);
+}
+
+
+/**
+ * Sets things up for running a script from the main loop as though it
+ * were handling an event for the window; returns the previous current
+ * window, for end_script_context
+ */
+static WnckWindow *begin_script_context(WnckWindow *window)
+{
+	WnckWindow *previous = get_current_window();
+
+	set_current_window(window);
+	begin_window_snapshot(window);
+	begin_window_changes();
+	script_begin_event();
+
+	return previous;
+}
+
+
+/**
+ *
+ */
+static void end_script_context(WnckWindow *previous)
+{
+	script_end_event();
+	end_window_snapshot();
+	flush_window_changes();
+	set_current_window(previous);
+
+	XFlush(gdk_x11_get_default_xdisplay());
+}
+
+
+/**
+ * Carry on with a suspended script, as though it were handling an event
+ * for its window; the values which the waiting function returns are on
+ * top of the thread's stack
+ */
+static void wake_script_thread(struct script_thread *st, int nargs)
+{
+	stop_waiting(st);
+
+	WnckWindow *previous = begin_script_context(st->window);
+	resume_script_thread(st, nargs);
+	end_script_context(previous);
+}
+
+
+/**
+ * Pushes what a wait_for_…() function returns once the wait is over
+ */
+static int push_wait_result(struct script_thread *st, gboolean timed_out)
+{
+	gchar *value;
+
+	switch (st->waiting) {
+	case SCRIPT_WAIT_PROPERTY:
+		value = timed_out ? NULL : my_wnck_get_string_property(st->xid, st->atom, NULL);
+		if (value)
+			lua_pushstring(st->thread, value);
+		else
+			lua_pushnil(st->thread);
+		g_free(value);
+		return 1;
+	case SCRIPT_WAIT_MAPPED:
+		lua_pushboolean(st->thread, !timed_out);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+
+/**
+ *
+ */
+static gboolean wait_timeout_cb(gpointer data)
+{
+	struct script_thread *st = data;
+
+	st->timeout_id = 0;
+	wake_script_thread(st, push_wait_result(st, TRUE));
+	return FALSE;
+}
+
+
+/**
+ *
+ */
+static gboolean wait_over_cb(gpointer data)
+{
+	struct script_thread *st = data;
+
+	st->wake_id = 0;
+	wake_script_thread(st, push_wait_result(st, FALSE));
+	return FALSE;
+}
+
+
+/**
+ * Looks for the X events which scripts are waiting for. The scripts are
+ * woken from the main loop rather than from here.
+ */
+static GdkFilterReturn wait_event_filter(GdkXEvent *gdk_xevent,
+                                         GdkEvent *event G_GNUC_UNUSED,
+                                         gpointer data G_GNUC_UNUSED)
+{
+	XEvent *xevent = (XEvent *)gdk_xevent;
+
+	if (xevent->type != PropertyNotify && xevent->type != MapNotify)
+		return GDK_FILTER_CONTINUE;
+
+	for (GList *item = waiting_threads; item; item = item->next) {
+		struct script_thread *st = item->data;
+
+		if (st->wake_id)
+			continue;
+
+		if ((st->waiting == SCRIPT_WAIT_PROPERTY &&
+		     xevent->type == PropertyNotify &&
+		     xevent->xproperty.window == st->xid &&
+		     xevent->xproperty.atom == st->atom &&
+		     xevent->xproperty.state == PropertyNewValue) ||
+		    (st->waiting == SCRIPT_WAIT_MAPPED &&
+		     xevent->type == MapNotify &&
+		     xevent->xmap.window == st->xid))
+			st->wake_id = g_idle_add(wait_over_cb, st);
+	}
+
+	return GDK_FILTER_CONTINUE;
+}
+
+
+/**
+ * Calls made through lua_pcall from C (window methods and find_windows()
+ * actions) can't yield on any Lua version, nor can close scripts, whose
+ * window is about to go; this counts how many of those we're inside
+ */
+static int no_wait_depth = 0;
+
+void script_begin_no_wait(void)
+{
+	no_wait_depth++;
+}
+
+void script_end_no_wait(void)
+{
+	no_wait_depth--;
+}
+
+
+/**
+ * Whether the script calling a function can be suspended, i.e. it's an
+ * event script (not one being loaded from scripts_with_handlers) and it
+ * isn't inside something which can't yield (such as a window method)
+ */
+gboolean script_can_wait(lua_State *lua)
+{
+	if (no_wait_depth)
+		return FALSE;
+#if LUA_VERSION_NUM >= 503
+	if (!lua_isyieldable(lua))
+		return FALSE;
+#endif
+	return running_thread && running_thread->thread == lua;
+}
+
+
+/**
+ * Suspends the running script until the timeout (in ms) expires or,
+ * unless this is a plain sleep, the window's property changes or it is
+ * mapped. Must be the return value of the calling C function.
+ */
+int script_wait(lua_State *lua, script_wait_type what, guint timeout, Window xid, Atom atom)
+{
+	struct script_thread *st = running_thread;
+
+	stop_waiting(st);
+
+	if (what != SCRIPT_WAIT_SLEEP && !watching_wait_events) {
+		gdk_window_add_filter(NULL, wait_event_filter, NULL);
+		watching_wait_events = TRUE;
+	}
+
+	st->waiting = what;
+	st->xid = xid;
+	st->atom = atom;
+	st->timeout_id = g_timeout_add(timeout, wait_timeout_cb, st);
+	waiting_threads = g_list_prepend(waiting_threads, st);
+
+	return lua_yield(lua, 0);
+}
+
+
+/**
+ * Stops any scripts which are waiting on a window which has closed
+ */
+void script_window_closed(WnckWindow *window)
+{
+	GList *item = waiting_threads;
+
+	while (item) {
+		struct script_thread *st = item->data;
+
+		item = item->next;
+		if (st->window == window)
+			free_script_thread(st);
+	}
+}
+
+
+/**
+ * Run the function on top of the stack (below which is the error handler)
+ * as a coroutine
+ */
+static int start_script_thread(lua_State *lua, int errpos)
+{
+	struct script_thread *st = g_new0(struct script_thread, 1);
+
+	lua_remove(lua, errpos); // errors are reported by resume_script_thread
+
+	st->lua = lua;
+	st->thread = lua_newthread(lua);
+	st->ref = luaL_ref(lua, LUA_REGISTRYINDEX);
+	st->window = get_current_window();
+	lua_xmove(lua, st->thread, 1);
+
+	resume_script_thread(st, 0);
+	return 0;
+}
+
+
+/**
+ * Returns the state (the main one) which scripts are run in, if lua is it
+ * or the script being run in it; else NULL
+ */
+lua_State *get_script_state(lua_State *lua)
+{
+	if (lua == global_lua_state)
+		return lua;
+	if (running_thread && running_thread->thread == lua)
+		return running_thread->lua;
+	return NULL;
+}
+
+
+/**
+ * Run the function on top of the stack (below which is the error handler)
+ */
+static int call_script(lua_State *lua, int errpos)
+{
+	gint64 limit = get_script_time_limit();
+
+	// handler scripts must have registered their handlers once loaded
+	if (lua == global_lua_state && !registering_handlers)
+		return start_script_thread(lua, errpos);
+
+	watched_lua = lua;
+	set_watchdog(limit);
+
+	int s = lua_pcall(lua, 0, LUA_MULTRET, errpos);
+
+	set_watchdog(0);
+	watched_lua = NULL;
+	lua_sethook(lua, NULL, 0, 0);
+	finish_layout_changes();
+
+	lua_remove(lua, errpos); // unstack the error handler
+
+	if (s) {
+		// no info to add here; just output the error
+		printf(_("Error: %s\n"), lua_tostring(lua, -1));
+		lua_pop(lua, 1); // else we leak it
+	}
+
+	return 0;
+}
+
+
 /**
  *
  */
 int
 run_script(lua_State *lua, const char *filename)
 {
-#define SCRIPT_TIMEOUT_SECONDS 5
-
 	if (!lua)
 		return -1;
 
 	lua_pushcfunction(lua, script_error);
 	int errpos = lua_gettop(lua);
 
-	int result = luaL_loadfile(lua, filename);
+	int result = load_script_file(lua, filename);
 
 	if (result) {
 		// We got an error, print it
@@ -312,31 +1082,134 @@ run_script(lua_State *lua, const char *filename)
 	}
 
 	// Okay, loaded the script; now run it
+	return call_script(lua, errpos);
+}
 
-	struct sigaction newact, oldact;
-	newact.sa_handler = timeout_script;
-	sigemptyset(&newact.sa_mask);
-	newact.sa_flags = 0;
 
-	timedout = FALSE;
-	lua_sethook(lua, check_timeout_script, LUA_MASKCOUNT, 1);
-	sigaction(SIGALRM, &newact, &oldact);
-	alarm(SCRIPT_TIMEOUT_SECONDS);
+/**
+ * As run_script, but the compiled script is cached for subsequent calls
+ */
+int
+run_cached_script(lua_State *lua, const char *filename)
+{
+	if (!lua)
+		return -1;
 
-	int s = lua_pcall(lua, 0, LUA_MULTRET, errpos);
+	if (script_event_expired()) {
+		if (devilspie2_debug)
+			printf(_("Skipping %s: event time budget exhausted\n"), filename);
+		return -1;
+	}
 
-	alarm(0);
-	sigaction(SIGALRM, &oldact, NULL);
+	lua_pushcfunction(lua, script_error);
+	int errpos = lua_gettop(lua);
 
-	lua_remove(lua, errpos); // unstack the error handler
+	int result = load_cached_script(lua, filename);
 
-	if (s) {
-		// no info to add here; just output the error
+	if (result) {
+		// We got an error, print it
 		printf(_("Error: %s\n"), lua_tostring(lua, -1));
-		lua_pop(lua, 1); // else we leak it
+		lua_remove(lua, errpos); // unstack the error handler
+		lua_pop(lua, 1);
+		return -1;
 	}
 
-	return 0;
+	return call_script(lua, errpos);
+}
+
+
+/**
+ * Run the function on top of the stack from the main loop, as though it
+ * were handling an event for the window (as for timers)
+ */
+void run_script_function(lua_State *lua, WnckWindow *window)
+{
+	WnckWindow *previous = begin_script_context(window);
+
+	lua_pushcfunction(lua, script_error);
+	lua_insert(lua, -2);
+	call_script(lua, lua_gettop(lua) - 1);
+
+	end_script_context(previous);
+}
+
+
+/**
+ * Event handlers
+ * Scripts listed in scripts_with_handlers are run once, when loaded, and
+ * register functions to be called for each event instead of being run
+ * from the top every time.
+ */
+static GSList *handlers[W_NUM_EVENTS] = { NULL, NULL, NULL, NULL, NULL };
+static lua_State *handlers_lua = NULL;
+
+
+/**
+ * Register the function on top of the stack as a handler for this event.
+ * Returns FALSE (and leaves the stack alone) if handler scripts aren't
+ * currently being loaded.
+ */
+gboolean add_script_handler(lua_State *lua, win_event_type event)
+{
+	if (!registering_handlers || lua != handlers_lua)
+		return FALSE;
+
+	int ref = luaL_ref(lua, LUA_REGISTRYINDEX);
+	handlers[event] = g_slist_append(handlers[event], GINT_TO_POINTER(ref));
+	return TRUE;
+}
+
+
+/**
+ *
+ */
+void clear_script_handlers(void)
+{
+	for (win_event_type i = 0; i < W_NUM_EVENTS; i++) {
+		for (GSList *item = handlers[i]; item; item = item->next)
+			luaL_unref(handlers_lua, LUA_REGISTRYINDEX, GPOINTER_TO_INT(item->data));
+		g_slist_free(handlers[i]);
+		handlers[i] = NULL;
+	}
+	handlers_lua = NULL;
+}
+
+
+/**
+ * (Re)load the handler scripts, discarding any previously registered handlers
+ */
+void load_script_handlers(lua_State *lua, GSList *file_list)
+{
+	clear_script_handlers();
+
+	handlers_lua = lua;
+	registering_handlers = TRUE;
+
+	for (; file_list; file_list = file_list->next)
+		run_cached_script(lua, (const char *)file_list->data);
+
+	registering_handlers = FALSE;
+}
+
+
+/**
+ * Call the functions registered for this event
+ */
+void run_script_handlers(lua_State *lua, win_event_type event)
+{
+	if (lua != handlers_lua)
+		return;
+
+	for (GSList *item = handlers[event]; item; item = item->next) {
+		if (script_event_expired())
+			break;
+
+		lua_pushcfunction(lua, script_error);
+		int errpos = lua_gettop(lua);
+
+		lua_rawgeti(lua, LUA_REGISTRYINDEX, GPOINTER_TO_INT(item->data));
+		call_script(lua, errpos);
+	}
 }
 
 
@@ -346,8 +1219,23 @@ run_script(lua_State *lua, const char *filename)
 void
 done_script(lua_State *lua)
 {
-	if (lua)
-		lua_close(lua);
+	if (!lua)
+		return;
+
+	if (script_chunks)
+		g_hash_table_foreach_remove(script_chunks, script_chunk_uses_state, lua);
+
+	GList *item = waiting_threads;
+	while (item) {
+		struct script_thread *st = item->data;
+
+		item = item->next;
+		if (st->lua == lua)
+			free_script_thread(st);
+	}
+	clear_timers(lua);
+
+	lua_close(lua);
 
 	//lua=NULL;
 }
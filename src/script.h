@@ -19,9 +19,19 @@
 #ifndef __HEADER_SCRIPT_
 #define __HEADER_SCRIPT_
 
+#include <X11/Xlib.h>
+
+#include "config.h"
+
 /**
- *
+ * What a suspended script is waiting for (besides its timeout)
  */
+typedef enum {
+	SCRIPT_WAIT_NONE,
+	SCRIPT_WAIT_SLEEP,
+	SCRIPT_WAIT_PROPERTY,
+	SCRIPT_WAIT_MAPPED
+} script_wait_type;
 
 
 /**
@@ -31,6 +41,28 @@ lua_State *init_script();
 
 void register_cfunctions(lua_State *lua);
 int run_script(lua_State *lua, const char *filename);
+int run_cached_script(lua_State *lua, const char *filename);
+void script_cache_invalidate(const char *filename);
+void set_bytecode_cache_folder(const gchar *folder);
+
+void set_script_timeouts(double script_seconds, double event_seconds);
+void script_begin_event(void);
+void script_end_event(void);
+gboolean script_event_expired(void);
+gchar *get_script_location(void);
+
+void script_begin_no_wait(void);
+void script_end_no_wait(void);
+gboolean script_can_wait(lua_State *lua);
+int script_wait(lua_State *lua, script_wait_type what, guint timeout, Window xid, Atom atom);
+void script_window_closed(WnckWindow *window);
+lua_State *get_script_state(lua_State *lua);
+void run_script_function(lua_State *lua, WnckWindow *window);
+
+gboolean add_script_handler(lua_State *lua, win_event_type event);
+void clear_script_handlers(void);
+void load_script_handlers(lua_State *lua, GSList *file_list);
+void run_script_handlers(lua_State *lua, win_event_type event);
 void done_script(lua_State *lua);
 
 
@@ -45,6 +45,10 @@
 #include <lualib.h>
 #include <lauxlib.h>
 
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen(lua, index) lua_objlen(lua, index)
+#endif
+
 #include <X11/extensions/Xrandr.h>
 
 #if (GTK_MAJOR_VERSION >= 3)
@@ -62,6 +66,8 @@
 
 #include "error_strings.h"
 
+#include "process_info.h"
+
 #define DEPRECATED() fprintf(stderr, "warning: deprecated function %s called\n", __func__ + 2);
 
 /**
@@ -322,7 +328,7 @@ static int do_set_window_position_internal(lua_State *restrict lua, const char *
 		 * -ve y: relative to bottom (bitwise NOT)
 		 */
 		GdkRectangle bounds, geom;
-		wnck_window_get_geometry(window, &geom.x, &geom.y, &geom.width, &geom.height);
+		get_window_geometry(window, &geom.x, &geom.y, &geom.width, &geom.height);
 		monitor = get_monitor_or_workspace_geometry(monitor, window, &bounds);
 		if (monitor == MONITOR_NONE)
 			return FALSE;
@@ -382,10 +388,10 @@ int c_set_window_geometry2(lua_State *lua)
 		int ysize = lua_tonumber(lua, 4);
 		WnckWindow *window = get_current_window();
 		if (window) {
-			XMoveResizeWindow(gdk_x11_get_default_xdisplay(),
-			                  wnck_window_get_xid(window),
-			                  x, y,
-			                  xsize, ysize);
+			configure_window(window,
+			                 WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y +
+			                 WNCK_WINDOW_CHANGE_WIDTH + WNCK_WINDOW_CHANGE_HEIGHT,
+			                 x, y, xsize, ysize);
 		}
 	}
 
@@ -409,10 +415,10 @@ int c_set_window_position(lua_State *lua)
 		if (window) {
 			if (adjusting_for_decoration)
 				adjust_for_decoration(window, &x, &y, NULL, NULL);
-			wnck_window_set_geometry(window,
-			                         WNCK_WINDOW_GRAVITY_CURRENT,
-			                         WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y,
-			                         x, y, -1, -1);
+			change_window_geometry(window,
+			                       WNCK_WINDOW_GRAVITY_CURRENT,
+			                       WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y,
+			                       x, y, -1, -1);
 		}
 	}
 
@@ -434,9 +440,8 @@ int c_set_window_position2(lua_State *lua)
 	else if (ret > 0) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			XMoveWindow(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()),
-			            wnck_window_get_xid(window),
-			            x, y);
+			configure_window(window, WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y,
+			                 x, y, -1, -1);
 		}
 	}
 
@@ -471,21 +476,12 @@ int c_set_window_size(lua_State *lua)
 
 		if (window) {
 
-			devilspie2_error_trap_push();
 			if (adjusting_for_decoration)
 				adjust_for_decoration (window, NULL, NULL, &x, &y);
-			wnck_window_set_geometry(window,
-			                         WNCK_WINDOW_GRAVITY_CURRENT,
-			                         WNCK_WINDOW_CHANGE_WIDTH + WNCK_WINDOW_CHANGE_HEIGHT,
-			                         -1, -1, x, y);
-
-			if (devilspie2_error_trap_pop()) {
-				gchar *temperror=
-				    g_strdup_printf("set_window_size: %s", failed_string);
-				g_printerr("%s", temperror);
-
-				g_free(temperror);
-			}
+			change_window_geometry(window,
+			                       WNCK_WINDOW_GRAVITY_CURRENT,
+			                       WNCK_WINDOW_CHANGE_WIDTH + WNCK_WINDOW_CHANGE_HEIGHT,
+			                       -1, -1, x, y);
 		}
 	}
 
@@ -494,23 +490,14 @@ int c_set_window_size(lua_State *lua)
 
 
 #define NUM_STRUTS 12
-static gulong *get_default_struts(Display *dpy)
+static gulong *get_default_struts(void)
 {
-	int screen = DefaultScreen(dpy);
 	int width, height;
 
 	static gulong struts[NUM_STRUTS];
 	memset (struts, 0, sizeof(struts));
-#ifdef HAVE_XRANDR
-	// If we have xrandr (we probably do), get the maximum screen size
-	int x; // throwaway
-	XRRGetScreenSizeRange (dpy, RootWindow(dpy, screen),
-	                       &x, &x, &width, &height);
-#else
-	// Otherwise, fall back to the current size
-	width = DisplayWidth(dpy, screen);
-	height = DisplayHeight(dpy, screen);
-#endif
+
+	get_max_screen_size(&width, &height);
 	struts[5] = struts[7] = height;
 	struts[9] = struts[11] = width;
 
@@ -535,7 +522,7 @@ int c_set_window_strut(lua_State *lua)
 	if (!devilspie2_emulate) {
 		Display *dpy = gdk_x11_get_default_xdisplay();
 
-		gulong *struts = get_default_struts(dpy);
+		gulong *struts = get_default_struts();
 		for (int i = 0; i < top; i++) {
 			struts[i] = lua_tonumber(lua, i + 1);
 		}
@@ -543,14 +530,18 @@ int c_set_window_strut(lua_State *lua)
 		WnckWindow *window = get_current_window();
 
 		if (window) {
+			invalidate_window_property(wnck_window_get_xid(window),
+			                           my_wnck_atom_get("_NET_WM_STRUT_PARTIAL"));
+			devilspie2_error_trap_push();
 			XChangeProperty(dpy,
 			                wnck_window_get_xid(window),
-			                XInternAtom(dpy, "_NET_WM_STRUT_PARTIAL", False), XA_CARDINAL,
+			                my_wnck_atom_get("_NET_WM_STRUT_PARTIAL"), XA_CARDINAL,
 			                32,
 			                PropModeReplace,
 			                (unsigned char*)struts,
 			                NUM_STRUTS);
-			XSync(dpy, False);
+			if (devilspie2_error_trap_pop())
+				g_printerr("set_window_strut: %s", failed_string);
 		}
 	}
 
@@ -571,18 +562,17 @@ int c_get_window_strut(lua_State *lua)
 	if (!window)
 		return 0;
 
-	Display *dpy = gdk_x11_get_default_xdisplay();
 	gulong *struts = NULL;
 	int len = 0;
 
 	gboolean ret = my_wnck_get_cardinal_list (wnck_window_get_xid(window),
-	                                          XInternAtom(dpy, "_NET_WM_STRUT_PARTIAL", False),
-	                                          &struts, &len);
+	                                          my_wnck_atom_get("_NET_WM_STRUT_PARTIAL"),
+	                                          &struts, &len, NUM_STRUTS);
 	/* if that fails, try reading the older, deprecated property */
 	if (!ret)
 		ret = my_wnck_get_cardinal_list (wnck_window_get_xid(window),
-		                                 XInternAtom(dpy, "_NET_WM_STRUT", False),
-		                                 &struts, &len);
+		                                 my_wnck_atom_get("_NET_WM_STRUT"),
+		                                 &struts, &len, NUM_STRUTS);
 
 	if (len) {
 		int i;
@@ -598,7 +588,7 @@ int c_get_window_strut(lua_State *lua)
 
 		// pad out with default values if necessary
 		if (len < NUM_STRUTS) {
-			struts = get_default_struts(dpy);
+			struts = get_default_struts();
 			for (; i < NUM_STRUTS; ++i) {
 				lua_pushinteger(lua, struts[i]);
 				lua_rawseti(lua, -2, i + 1);
@@ -622,7 +612,7 @@ int c_make_always_on_top(lua_State *lua)
 		WnckWindow *window = get_current_window();
 
 		if (window) {
-			wnck_window_make_above(window);
+			change_window_state(window, TRUE, my_wnck_atom_get("_NET_WM_STATE_ABOVE"), None);
 		}
 	}
 
@@ -643,7 +633,7 @@ int c_set_on_top(lua_State *lua)
 		WnckWindow *window = get_current_window();
 
 		if (window)
-			XRaiseWindow(gdk_x11_get_default_xdisplay(), wnck_window_get_xid(window));
+			restack_window(window, 1);
 	}
 
 	return 0;
@@ -663,7 +653,7 @@ int c_set_on_bottom(lua_State *lua)
 		WnckWindow *window = get_current_window();
 
 		if (window)
-			XLowerWindow(gdk_x11_get_default_xdisplay(), wnck_window_get_xid(window));
+			restack_window(window, -1);
 	}
 
 	return 0;
@@ -743,7 +733,7 @@ int c_shade(lua_State *lua)
 		WnckWindow *window = get_current_window();
 
 		if (window) {
-			wnck_window_shade(window);
+			change_window_state(window, TRUE, my_wnck_atom_get("_NET_WM_STATE_SHADED"), None);
 		}
 	}
 
@@ -764,7 +754,7 @@ int c_unshade(lua_State *lua)
 		WnckWindow *window = get_current_window();
 
 		if (window) {
-			wnck_window_unshade(window);
+			change_window_state(window, FALSE, my_wnck_atom_get("_NET_WM_STATE_SHADED"), None);
 		}
 	}
 
@@ -785,6 +775,7 @@ int c_minimize(lua_State *lua)
 		WnckWindow *window = get_current_window();
 
 		if (window) {
+			send_window_changes_now(window);
 			wnck_window_minimize(window);
 		}
 	}
@@ -806,6 +797,7 @@ int c_unminimize(lua_State *lua)
 		WnckWindow *window = get_current_window();
 
 		if (window) {
+			send_window_changes_now(window);
 			wnck_window_unminimize (window, current_time());
 		}
 	}
@@ -832,6 +824,74 @@ WnckWindow *get_current_window()
 }
 
 
+/**
+ * Whatever is slow to find out about the window which an event is for
+ * (anything which needs /proc or a round trip to the X server) is fetched
+ * the first time that a script, or script_match, asks for it, then kept
+ * for every other script run for that event.
+ */
+struct window_snapshot {
+	WnckWindow *window;
+	gboolean have_process_name, have_process_owner, have_frame_extents;
+	gchar *process_name;
+	gchar *process_owner;
+	int frame_extents[4];
+};
+
+static struct window_snapshot snapshot;
+static gboolean snapshot_active = FALSE;
+
+
+/**
+ *
+ */
+static void clear_window_snapshot(WnckWindow *window)
+{
+	g_free(snapshot.process_name);
+	g_free(snapshot.process_owner);
+	memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.window = window;
+}
+
+
+/**
+ * Starts a snapshot for an event's window; anything already known about
+ * any other window is forgotten
+ */
+void begin_window_snapshot(WnckWindow *window)
+{
+	clear_window_snapshot(window);
+	snapshot_active = TRUE;
+}
+
+
+/**
+ *
+ */
+void end_window_snapshot(void)
+{
+	clear_window_snapshot(NULL);
+	snapshot_active = FALSE;
+}
+
+
+/**
+ * Returns the snapshot for this window, or NULL if there's no event being
+ * handled. A window other than the event's (as in on_geometry_changed
+ * callbacks) replaces the snapshot.
+ */
+static struct window_snapshot *get_window_snapshot(WnckWindow *window)
+{
+	if (!snapshot_active || !window)
+		return NULL;
+
+	if (snapshot.window != window)
+		clear_window_snapshot(window);
+
+	return &snapshot;
+}
+
+
 /**
  * Decorates a window
  */
@@ -931,6 +991,15 @@ int find_workspace_with_name(gchar *in_workspace_name, WnckWindow *window){
 	
 	WnckScreen *screen = wnck_window_get_screen(window);
 
+	// the default screen's workspace names are indexed (but there may be
+	// more names than workspaces)
+	if (wnck_screen_get_number(screen) == DefaultScreen(gdk_x11_get_default_xdisplay())) {
+		int space = get_workspace_index_by_name(in_workspace_name);
+		if (space >= 0 && space < wnck_screen_get_workspace_count(screen))
+			return space;
+	}
+
+	// otherwise (or for names which libwnck makes up) look through them all
 	for (int space = 0; space < wnck_screen_get_workspace_count(screen); space++) {
 		WnckWorkspace *workspace = wnck_screen_get_workspace(screen, space);
 		if(workspace == NULL) //Theoretically possible
@@ -987,7 +1056,7 @@ int c_set_window_workspace(lua_State *lua)
 			g_warning(_("Workspace number %d does not exist!"), workspace_idx0+1);
 		}
 		if (!devilspie2_emulate) {
-			wnck_window_move_to_workspace(window, workspace);
+			change_window_workspace(window, workspace_idx0);
 		}
 	}
 
@@ -1087,7 +1156,8 @@ int c_unmaximize(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_unmaximize(window);
+			change_window_state(window, FALSE, my_wnck_atom_get("_NET_WM_STATE_MAXIMIZED_VERT"),
+			                    my_wnck_atom_get("_NET_WM_STATE_MAXIMIZED_HORZ"));
 		}
 	}
 
@@ -1107,7 +1177,8 @@ int c_maximize(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_maximize(window);
+			change_window_state(window, TRUE, my_wnck_atom_get("_NET_WM_STATE_MAXIMIZED_VERT"),
+			                    my_wnck_atom_get("_NET_WM_STATE_MAXIMIZED_HORZ"));
 		}
 	}
 	return 0;
@@ -1126,7 +1197,7 @@ int c_maximize_vertically(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_maximize_vertically(window);
+			change_window_state(window, TRUE, my_wnck_atom_get("_NET_WM_STATE_MAXIMIZED_VERT"), None);
 		}
 	}
 
@@ -1146,7 +1217,7 @@ int c_maximize_horizontally(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_maximize_horizontally(window);
+			change_window_state(window, TRUE, my_wnck_atom_get("_NET_WM_STATE_MAXIMIZED_HORZ"), None);
 		}
 	}
 
@@ -1172,7 +1243,7 @@ int c_pin_window(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_pin(window);
+			change_window_workspace(window, WORKSPACE_PIN);
 		}
 	}
 
@@ -1193,7 +1264,7 @@ int c_unpin_window(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_unpin(window);
+			change_window_workspace(window, WORKSPACE_UNPIN);
 		}
 	}
 
@@ -1213,7 +1284,7 @@ int c_stick_window(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_stick(window);
+			change_window_state(window, TRUE, my_wnck_atom_get("_NET_WM_STATE_STICKY"), None);
 		}
 	}
 
@@ -1233,7 +1304,7 @@ int c_unstick_window(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_unstick(window);
+			change_window_state(window, FALSE, my_wnck_atom_get("_NET_WM_STATE_STICKY"), None);
 		}
 	}
 
@@ -1255,7 +1326,7 @@ int c_get_window_geometry(lua_State *lua)
 	WnckWindow *window = get_current_window();
 	if (window)
 	{
-		wnck_window_get_geometry(window, &x, &y, &width, &height);
+		get_window_geometry(window, &x, &y, &width, &height);
 	}
 
 	lua_pushinteger(lua, x);
@@ -1294,6 +1365,53 @@ int c_get_window_client_geometry(lua_State *lua)
 }
 
 
+/**
+ * Gets the frame extents (left, right, top, bottom) of a window
+ */
+static void get_window_frame_extents(WnckWindow *window, int extents[4])
+{
+	struct window_snapshot *snap = get_window_snapshot(window);
+
+	if (snap && snap->have_frame_extents) {
+		memcpy(extents, snap->frame_extents, sizeof(snap->frame_extents));
+		return;
+	}
+
+	// Order of preference:
+	// _NET_FRAME_EXTENTS
+	// Calculation from geometries
+
+	gulong *property = 0;
+	int len = 0;
+
+	my_wnck_get_cardinal_list (wnck_window_get_xid(window),
+	                           my_wnck_atom_get("_NET_FRAME_EXTENTS"),
+	                           &property, &len, 4);
+	if (len >= 4) {
+		// _NET_FRAME_EXTENTS
+		for (int i = 0; i < 4; i++)
+			extents[i] = property[i];
+		g_free(property);
+	}
+	else {
+		// Calculation from geometries
+		int frame[4] = {}, client[4] = {};
+
+		wnck_window_get_geometry(window, frame, frame + 1, frame + 2, frame + 3);
+		wnck_window_get_client_window_geometry(window, client, client + 1, client + 2, client + 3);
+		extents[0] = client[0] - frame[0];
+		extents[1] = frame[2] - client[2] - extents[0];
+		extents[2] = client[1] - frame[1];
+		extents[3] = frame[3] - client[3] - extents[2];
+	}
+
+	if (snap) {
+		memcpy(snap->frame_extents, extents, sizeof(snap->frame_extents));
+		snap->have_frame_extents = TRUE;
+	}
+}
+
+
 /**
  * return the window frame extents
  */
@@ -1303,46 +1421,14 @@ int c_get_window_frame_extents(lua_State *lua)
 		return 0;
 	}
 
-	int left = 0, right = 0, top = 0, bottom = 0;
+	int extents[4] = {};
 
 	WnckWindow *window = get_current_window();
-	if (window) {
-		// Order of preference:
-		// _NET_FRAME_EXTENTS
-		// Calculation from geometries
+	if (window)
+		get_window_frame_extents(window, extents);
 
-		Display *dpy = gdk_x11_get_default_xdisplay();
-		gulong *extents = 0;
-		int len = 0;
-
-		my_wnck_get_cardinal_list (wnck_window_get_xid(window),
-		                           XInternAtom(dpy, "_NET_FRAME_EXTENTS", False),
-		                           &extents, &len);
-		if (len >= 4) {
-			// _NET_FRAME_EXTENTS
-			left = extents[0];
-			right = extents[1];
-			top = extents[2];
-			bottom = extents[3];
-			g_free(extents);
-		}
-		else {
-			// Calculation from geometries
-			int frame[4] = {}, client[4] = {};
-
-			wnck_window_get_geometry(window, frame, frame + 1, frame + 2, frame + 3);
-			wnck_window_get_client_window_geometry(window, client, client + 1, client + 2, client + 3);
-			left = client[0] - frame[0];
-			right = frame[2] - client[2] - left;
-			top = client[1] - frame[1];
-			bottom = frame[3] - client[3] - top;
-		}
-	}
-
-	lua_pushinteger(lua, left);
-	lua_pushinteger(lua, right);
-	lua_pushinteger(lua, top);
-	lua_pushinteger(lua, bottom);
+	for (int i = 0; i < 4; i++)
+		lua_pushinteger(lua, extents[i]);
 
 	return 4;
 }
@@ -1371,7 +1457,7 @@ int c_set_skip_tasklist(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_set_skip_tasklist(window, skip_tasklist);
+			change_window_state(window, skip_tasklist, my_wnck_atom_get("_NET_WM_STATE_SKIP_TASKBAR"), None);
 		}
 	}
 
@@ -1402,7 +1488,7 @@ int c_set_skip_pager(lua_State *lua)
 	if (!devilspie2_emulate) {
 		WnckWindow *window = get_current_window();
 		if (window) {
-			wnck_window_set_skip_pager(window, skip_pager);
+			change_window_state(window, skip_pager, my_wnck_atom_get("_NET_WM_STATE_SKIP_PAGER"), None);
 		}
 	}
 
@@ -1410,6 +1496,26 @@ int c_set_skip_pager(lua_State *lua)
 }
 
 
+/**
+ * Whether the window is maximized vertically and/or horizontally,
+ * including any change not yet sent
+ */
+static gboolean window_is_maximized(WnckWindow *window, gboolean vertically, gboolean horizontally)
+{
+	if (vertically &&
+	    !get_window_state(window, my_wnck_atom_get("_NET_WM_STATE_MAXIMIZED_VERT"),
+	                      wnck_window_is_maximized_vertically(window)))
+		return FALSE;
+
+	if (horizontally &&
+	    !get_window_state(window, my_wnck_atom_get("_NET_WM_STATE_MAXIMIZED_HORZ"),
+	                      wnck_window_is_maximized_horizontally(window)))
+		return FALSE;
+
+	return TRUE;
+}
+
+
 /**
  *
  */
@@ -1420,7 +1526,7 @@ int c_get_window_is_maximized(lua_State *lua)
 	}
 
 	WnckWindow *window = get_current_window();
-	gboolean is_maximized = window ? wnck_window_is_maximized(window) : FALSE;
+	gboolean is_maximized = window ? window_is_maximized(window, TRUE, TRUE) : FALSE;
 
 	lua_pushboolean(lua, is_maximized);
 
@@ -1437,7 +1543,7 @@ int c_get_window_is_maximized_vertically(lua_State *lua)
 	}
 
 	WnckWindow *window = get_current_window();
-	gboolean is_vertically_maximized = window ? wnck_window_is_maximized_vertically(window) : FALSE;
+	gboolean is_vertically_maximized = window ? window_is_maximized(window, TRUE, FALSE) : FALSE;
 
 	lua_pushboolean(lua, is_vertically_maximized);
 
@@ -1455,7 +1561,7 @@ int c_get_window_is_maximized_horizontally(lua_State *lua)
 	}
 
 	WnckWindow *window = get_current_window();
-	gboolean is_horizontally_maximized = window ? wnck_window_is_maximized_horizontally(window) : FALSE;
+	gboolean is_horizontally_maximized = window ? window_is_maximized(window, FALSE, TRUE) : FALSE;
 
 	lua_pushboolean(lua, is_horizontally_maximized);
 
@@ -1469,6 +1575,22 @@ int c_get_window_is_maximized_horisontally(lua_State *lua)
 }
 
 
+/**
+ * Whether the window is pinned, including any change not yet sent
+ */
+static gboolean window_is_pinned(WnckWindow *window)
+{
+	switch (get_pending_workspace(window)) {
+	case WORKSPACE_NONE:
+		return wnck_window_is_pinned(window);
+	case WORKSPACE_PIN:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+
 /**
  *
  */
@@ -1479,7 +1601,7 @@ int c_get_window_is_pinned(lua_State *lua)
 	}
 
 	WnckWindow *window = get_current_window();
-	gboolean is_pinned = window ? wnck_window_is_pinned(window) : FALSE;
+	gboolean is_pinned = window ? window_is_pinned(window) : FALSE;
 
 	lua_pushboolean(lua, is_pinned);
 
@@ -1517,9 +1639,9 @@ int c_set_window_above(lua_State *lua)
 
 		if (window) {
 			if (set_above)
-				wnck_window_make_above(window);
+				change_window_state(window, TRUE, my_wnck_atom_get("_NET_WM_STATE_ABOVE"), None);
 			else
-				wnck_window_unmake_above(window);
+				change_window_state(window, FALSE, my_wnck_atom_get("_NET_WM_STATE_ABOVE"), None);
 		}
 	}
 
@@ -1557,9 +1679,9 @@ int c_set_window_below(lua_State *lua)
 
 		if (window) {
 			if (set_below)
-				wnck_window_make_below(window);
+				change_window_state(window, TRUE, my_wnck_atom_get("_NET_WM_STATE_BELOW"), None);
 			else
-				wnck_window_unmake_below(window);
+				change_window_state(window, FALSE, my_wnck_atom_get("_NET_WM_STATE_BELOW"), None);
 		}
 	}
 
@@ -1576,47 +1698,40 @@ int c_get_window_type(lua_State *lua)
 		return 0;
 	}
 
-	WnckWindow *window = get_current_window();
-	const char *window_type_string;
+	lua_pushstring(lua, get_window_type_name(get_current_window()));
 
-	if (window) {
-		WnckWindowType window_type = wnck_window_get_window_type(window);
-
-		switch (window_type) {
-		case WNCK_WINDOW_NORMAL:
-			window_type_string = "WINDOW_TYPE_NORMAL";
-			break;
-		case WNCK_WINDOW_DESKTOP:
-			window_type_string = "WINDOW_TYPE_DESKTOP";
-			break;
-		case WNCK_WINDOW_DOCK:
-			window_type_string = "WINDOW_TYPE_DOCK";
-			break;
-		case WNCK_WINDOW_DIALOG:
-			window_type_string = "WINDOW_TYPE_DIALOG";
-			break;
-		case WNCK_WINDOW_TOOLBAR:
-			window_type_string = "WINDOW_TYPE_TOOLBAR";
-			break;
-		case WNCK_WINDOW_MENU:
-			window_type_string = "WINDOW_TYPE_MENU";
-			break;
-		case WNCK_WINDOW_UTILITY:
-			window_type_string = "WINDOW_TYPE_UTILITY";
-			break;
-		case WNCK_WINDOW_SPLASHSCREEN:
-			window_type_string = "WINDOW_TYPE_SPLASHSCREEN";
-			break;
-		default:
-			window_type_string = "WINDOW_TYPE_UNRECOGNIZED";
-		};
-	} else {
-		window_type_string = "WINDOW_ERROR";
-	}
+	return 1;
+}
 
-	lua_pushstring(lua, window_type_string);
 
-	return 1;
+/**
+ * Get the window type as used by get_window_type()
+ */
+const char *get_window_type_name(WnckWindow *window)
+{
+	if (!window)
+		return "WINDOW_ERROR";
+
+	switch (wnck_window_get_window_type(window)) {
+	case WNCK_WINDOW_NORMAL:
+		return "WINDOW_TYPE_NORMAL";
+	case WNCK_WINDOW_DESKTOP:
+		return "WINDOW_TYPE_DESKTOP";
+	case WNCK_WINDOW_DOCK:
+		return "WINDOW_TYPE_DOCK";
+	case WNCK_WINDOW_DIALOG:
+		return "WINDOW_TYPE_DIALOG";
+	case WNCK_WINDOW_TOOLBAR:
+		return "WINDOW_TYPE_TOOLBAR";
+	case WNCK_WINDOW_MENU:
+		return "WINDOW_TYPE_MENU";
+	case WNCK_WINDOW_UTILITY:
+		return "WINDOW_TYPE_UTILITY";
+	case WNCK_WINDOW_SPLASHSCREEN:
+		return "WINDOW_TYPE_SPLASHSCREEN";
+	default:
+		return "WINDOW_TYPE_UNRECOGNIZED";
+	}
 }
 
 
@@ -1708,8 +1823,91 @@ static int c_get_window_property_internal(lua_State *lua, const char *func, gboo
 	return ret;
 }
 
+/**
+ * get_window_property(name, {offset = n, max_bytes = n})
+ * Reads just part of a property, without converting it to a string first.
+ * Returns the value (a string for 8-bit data, else a table of numbers or
+ * atom names) and the size of the whole property in bytes.
+ */
+static int c_get_window_property_range(lua_State *lua)
+{
+	if (lua_type(lua, 1) != LUA_TSTRING) {
+		luaL_error(lua, "get_window_property: %s", string_expected_as_indata_error);
+		return 0;
+	}
+	if (lua_type(lua, 2) != LUA_TTABLE) {
+		luaL_error(lua, "get_window_property: %s", table_expected_as_indata_error);
+		return 0;
+	}
+
+	lua_Number offset = 0, max_bytes = G_MAXLONG;
+
+	lua_getfield(lua, 2, "offset");
+	if (lua_type(lua, -1) == LUA_TNUMBER)
+		offset = lua_tonumber(lua, -1);
+	lua_getfield(lua, 2, "max_bytes");
+	if (lua_type(lua, -1) == LUA_TNUMBER)
+		max_bytes = lua_tonumber(lua, -1);
+	lua_pop(lua, 2);
+
+	if (offset < 0 || max_bytes < 0) {
+		luaL_error(lua, "get_window_property: %s", non_negative_integer_expected_error);
+		return 0;
+	}
+
+	WnckWindow *window = get_current_window();
+
+	if (!window) {
+		lua_pushnil(lua);
+		return 1;
+	}
+
+	Atom type;
+	int format;
+	gulong nitems, total;
+	unsigned char *data = my_wnck_get_property_range(wnck_window_get_xid(window),
+	                                                 my_wnck_atom_get(lua_tostring(lua, 1)),
+	                                                 (gulong)MIN(offset, G_MAXLONG), (gulong)MIN(max_bytes, G_MAXLONG),
+	                                                 &type, &format, &nitems, &total);
+
+	if (type == None) {
+		lua_pushnil(lua);
+	} else if (format == 8) {
+		// straight from Xlib's buffer
+		lua_pushlstring(lua, data ? (const char *)data : "", nitems);
+	} else if (format == 32 && type == XA_ATOM) {
+		const char **names = g_new0(const char *, nitems + 1);
+
+		my_wnck_atom_names((Atom *)data, nitems, names);
+		lua_createtable(lua, nitems, 0);
+		for (gulong i = 0; i < nitems; ++i) {
+			lua_pushstring(lua, names[i]);
+			lua_rawseti(lua, -2, i + 1);
+		}
+		g_free(names);
+	} else {
+		lua_createtable(lua, nitems, 0);
+		for (gulong i = 0; i < nitems; ++i) {
+			if (format == 16)
+				lua_pushnumber(lua, ((short *)data)[i]);
+			else
+				lua_pushnumber(lua, ((unsigned long *)data)[i]);
+			lua_rawseti(lua, -2, i + 1);
+		}
+	}
+
+	if (data)
+		XFree(data);
+
+	lua_pushnumber(lua, total);
+	return 2;
+}
+
 int c_get_window_property(lua_State *lua)
 {
+	if (lua_gettop(lua) == 2)
+		return c_get_window_property_range(lua);
+
 	return c_get_window_property_internal(lua, "get_window_property", 1);
 }
 
@@ -1724,6 +1922,71 @@ int c_get_window_property_full(lua_State *lua)
 }
 
 
+/**
+ * get_window_properties({ "NAME", ... })
+ * Returns a table of property name → value. The properties are all
+ * requested before waiting for any of the replies.
+ */
+int c_get_window_properties(lua_State *lua)
+{
+	if (!check_param_count(lua, "get_window_properties", 1)) {
+		return 0;
+	}
+
+	if (lua_type(lua, 1) != LUA_TTABLE) {
+		luaL_error(lua, "get_window_properties: %s", table_expected_as_indata_error);
+		return 0;
+	}
+
+	WnckWindow *window = get_current_window();
+
+	if (!window) {
+		lua_pushnil(lua);
+		return 1;
+	}
+
+	int count = lua_rawlen(lua, 1);
+	const char **names = g_new(const char *, count);
+	Atom *atoms = g_new(Atom, count);
+	char **values = g_new(char *, count);
+	gboolean *utf8 = g_new(gboolean, count);
+
+	for (int i = 0; i < count; i++) {
+		lua_rawgeti(lua, 1, i + 1);
+		if (lua_type(lua, -1) != LUA_TSTRING) {
+			g_free(utf8);
+			g_free(values);
+			g_free(atoms);
+			g_free(names);
+			luaL_error(lua, "get_window_properties: %s", string_expected_as_indata_error);
+			return 0;
+		}
+		// still referenced by the table
+		names[i] = lua_tostring(lua, -1);
+		atoms[i] = my_wnck_atom_get(names[i]);
+		lua_pop(lua, 1);
+	}
+
+	my_wnck_get_string_properties(wnck_window_get_xid(window), atoms, count, values, utf8);
+
+	lua_createtable(lua, 0, count);
+	for (int i = 0; i < count; i++) {
+		if (values[i]) {
+			lua_pushstring(lua, values[i]);
+			lua_setfield(lua, -2, names[i]);
+		}
+		g_free(values[i]);
+	}
+
+	g_free(utf8);
+	g_free(values);
+	g_free(atoms);
+	g_free(names);
+
+	return 1;
+}
+
+
 /**
  *
  */
@@ -1861,7 +2124,17 @@ int c_get_window_class(lua_State *lua)
 		return 0;
 	}
 
-	WnckWindow *window = get_current_window();
+	lua_pushstring(lua, get_window_class_name(get_current_window()));
+
+	return 1;
+}
+
+
+/**
+ * Get the window class as used by get_window_class()
+ */
+const char *get_window_class_name(WnckWindow *window)
+{
 	const char *result = "";
 
 	if (window) {
@@ -1879,9 +2152,7 @@ int c_get_window_class(lua_State *lua)
 		}
 	}
 
-	lua_pushstring(lua, result);
-
-	return 1;
+	return result;
 }
 
 
@@ -1907,7 +2178,7 @@ int c_set_window_fullscreen(lua_State *lua)
 	gboolean fullscreen = lua_toboolean(lua, 1);
 
 	if (!devilspie2_emulate && window) {
-		wnck_window_set_fullscreen(window, fullscreen);
+		change_window_state(window, fullscreen, my_wnck_atom_get("_NET_WM_STATE_FULLSCREEN"), None);
 	}
 
 
@@ -1960,7 +2231,7 @@ int c_set_viewport(lua_State *lua)
 
 		screen = wnck_window_get_screen(window);
 
-		wnck_window_get_geometry(window, &win_x, &win_y, &width, &height);
+		get_window_geometry(window, &win_x, &win_y, &width, &height);
 
 		xid = wnck_window_get_xid(window);
 
@@ -1974,16 +2245,10 @@ int c_set_viewport(lua_State *lua)
 		x = ((num - 1) * wnck_screen_get_width(screen)) - viewport_start_x + win_x;
 
 		if (!devilspie2_emulate) {
-			devilspie2_error_trap_push();
-			XMoveResizeWindow(gdk_x11_get_default_xdisplay(),
-			                  wnck_window_get_xid(window),
-			                  x, win_y, width, height);
-
-			if (devilspie2_error_trap_pop()) {
-				g_printerr("set_viewport: %s", setting_viewport_failed_error);
-				lua_pushboolean(lua, FALSE);
-				return 1;
-			}
+			configure_window(window,
+			                 WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y +
+			                 WNCK_WINDOW_CHANGE_WIDTH + WNCK_WINDOW_CHANGE_HEIGHT,
+			                 x, win_y, width, height);
 		}
 
 		lua_pushboolean(lua, TRUE);
@@ -2014,7 +2279,7 @@ int c_set_viewport(lua_State *lua)
 			return 1;
 		}
 
-		wnck_window_get_geometry(window, &win_x, &win_y, &width, &height);
+		get_window_geometry(window, &win_x, &win_y, &width, &height);
 
 		xid = wnck_window_get_xid(window);
 
@@ -2026,16 +2291,10 @@ int c_set_viewport(lua_State *lua)
 		}
 
 		if (!devilspie2_emulate) {
-			devilspie2_error_trap_push();
-			XMoveResizeWindow(gdk_x11_get_default_xdisplay(),
-			                  wnck_window_get_xid(window),
-			                  new_xpos, new_ypos, width, height);
-
-			if (devilspie2_error_trap_pop()) {
-				g_printerr("set_viewport: %s", setting_viewport_failed_error);
-				lua_pushboolean(lua, FALSE);
-				return 1;
-			}
+			configure_window(window,
+			                 WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y +
+			                 WNCK_WINDOW_CHANGE_WIDTH + WNCK_WINDOW_CHANGE_HEIGHT,
+			                 new_xpos, new_ypos, width, height);
 		}
 
 		lua_pushboolean(lua, TRUE);
@@ -2066,7 +2325,7 @@ int c_center(lua_State *lua)
 		return 1;
 	}
 
-	wnck_window_get_geometry(window, &window_r.x, &window_r.y, &window_r.width, &window_r.height);
+	get_window_geometry(window, &window_r.x, &window_r.y, &window_r.width, &window_r.height);
 
 	int monitor_no = MONITOR_ALL;
 	enum { CENTRE_NONE, CENTRE_H, CENTRE_V, CENTRE_HV } centre = CENTRE_HV;
@@ -2120,16 +2379,8 @@ int c_center(lua_State *lua)
 		window_r.y = desktop_r.y + desktop_r.height - window_r.height;
 
 	if (!devilspie2_emulate) {
-		devilspie2_error_trap_push();
-		XMoveWindow (gdk_x11_get_default_xdisplay(),
-		             wnck_window_get_xid(window),
-		             window_r.x, window_r.y);
-
-		if (devilspie2_error_trap_pop()) {
-			g_printerr("center: %s", failed_string);
-			lua_pushboolean(lua, FALSE);
-			return 1;
-		}
+		configure_window(window, WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y,
+		                 window_r.x, window_r.y, -1, -1);
 	}
 
 	lua_pushboolean(lua, TRUE);
@@ -2234,6 +2485,7 @@ int c_focus(lua_State *lua)
 	WnckWindow *window = get_current_window();
 
 	if (!devilspie2_emulate && window) {
+		send_window_changes_now(window);
 		wnck_window_activate(window, current_time());
 	}
 
@@ -2253,6 +2505,7 @@ int c_close_window(lua_State *lua)
 	WnckWindow *window = get_current_window();
 
 	if (!devilspie2_emulate && window) {
+		send_window_changes_now(window);
 		wnck_window_close(window, current_time());
 	}
 
@@ -2273,7 +2526,8 @@ int c_get_window_fullscreen(lua_State *lua)
 
 	WnckWindow *window = get_current_window();
 	if (window) {
-		result = wnck_window_is_fullscreen(window);
+		result = get_window_state(window, my_wnck_atom_get("_NET_WM_STATE_FULLSCREEN"),
+		                          wnck_window_is_fullscreen(window));
 	}
 
 	lua_pushboolean(lua, result);
@@ -2370,7 +2624,7 @@ int c_xy(lua_State *lua)
 
 			int x, y, width, height;
 
-			wnck_window_get_geometry(window, &x, &y, &width, &height);
+			get_window_geometry(window, &x, &y, &width, &height);
 
 			lua_pushinteger(lua, x);
 			lua_pushinteger(lua, y);
@@ -2402,10 +2656,10 @@ int c_xy(lua_State *lua)
 			if (window) {
 				if (adjusting_for_decoration)
 					adjust_for_decoration (window, &x, &y, NULL, NULL);
-				wnck_window_set_geometry(window,
-				                         WNCK_WINDOW_GRAVITY_CURRENT,
-				                         WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y,
-				                         x, y, -1, -1);
+				change_window_geometry(window,
+				                       WNCK_WINDOW_GRAVITY_CURRENT,
+				                       WNCK_WINDOW_CHANGE_X + WNCK_WINDOW_CHANGE_Y,
+				                       x, y, -1, -1);
 			}
 		}
 		break;
@@ -2437,7 +2691,7 @@ int c_xywh(lua_State *lua)
 
 			    int x, y, width, height;
 
-			    wnck_window_get_geometry(window, &x, &y, &width, &height);
+			    get_window_geometry(window, &x, &y, &width, &height);
 
 			    lua_pushinteger(lua, x);
 			    lua_pushinteger(lua, y);
@@ -2484,6 +2738,42 @@ int c_xywh(lua_State *lua)
 	return 0;
 }
 
+/**
+ * begin_layout()
+ * Collects moves, resizes, state, workspace and stacking changes, for any
+ * number of windows, until commit_layout(). Returns false if a layout has
+ * already been started.
+ */
+int c_begin_layout(lua_State *lua)
+{
+	if (!check_param_count(lua, "begin_layout", 0)) {
+		return 0;
+	}
+
+	lua_pushboolean(lua, begin_layout_changes());
+	return 1;
+}
+
+
+/**
+ * commit_layout()
+ * Sends everything collected since begin_layout() in one go
+ */
+int c_commit_layout(lua_State *lua)
+{
+	if (!check_param_count(lua, "commit_layout", 0)) {
+		return 0;
+	}
+
+	gboolean result = commit_layout_changes();
+
+	if (result)
+		XFlush(gdk_x11_get_default_xdisplay());
+
+	lua_pushboolean(lua, result);
+	return 1;
+}
+
 struct lua_callback {
 	lua_State *lua;
 	int ref;
@@ -2499,6 +2789,7 @@ static void on_geometry_changed(WnckWindow *window, struct lua_callback *callbac
 
 	lua_rawgeti(callback->lua, LUA_REGISTRYINDEX, callback->ref);
 	lua_pcall(callback->lua, 0, 0, 0);
+	finish_layout_changes();
 
 	set_current_window(old_window);
 }
@@ -2523,7 +2814,8 @@ int c_on_geometry_changed(lua_State *lua)
 	}
 
 	struct lua_callback *cb = g_malloc(sizeof(struct lua_callback));
-	cb->lua = lua;
+	// not the script's own coroutine, which may be gone by the time this is called
+	cb->lua = get_script_state(lua) ? get_script_state(lua) : lua;
 	cb->ref = luaL_ref(lua, LUA_REGISTRYINDEX);
 
 	WnckWindow *window = get_current_window();
@@ -2535,12 +2827,58 @@ int c_on_geometry_changed(lua_State *lua)
 	return 0;
 }
 
+/**
+ * Register a handler function for an event
+ * (only from scripts listed in scripts_with_handlers, while being loaded)
+ */
+static int register_handler(lua_State *lua, const char *funcname, win_event_type event)
+{
+	if (!check_param_count(lua, funcname, 1)) {
+		return 0;
+	}
+
+	if (lua_type(lua, 1) != LUA_TFUNCTION) {
+		luaL_error(lua, "%s: %s", funcname, "function expected");
+		return 0;
+	}
+
+	if (!add_script_handler(lua, event))
+		luaL_error(lua, "%s: %s", funcname, _("only usable while loading scripts_with_handlers"));
+
+	return 0;
+}
+
+int c_on_window_open(lua_State *lua)
+{
+	return register_handler(lua, "on_window_open", W_OPEN);
+}
+
+int c_on_window_close(lua_State *lua)
+{
+	return register_handler(lua, "on_window_close", W_CLOSE);
+}
+
+int c_on_focus(lua_State *lua)
+{
+	return register_handler(lua, "on_focus", W_FOCUS);
+}
+
+int c_on_blur(lua_State *lua)
+{
+	return register_handler(lua, "on_blur", W_BLUR);
+}
+
+int c_on_name_change(lua_State *lua)
+{
+	return register_handler(lua, "on_name_change", W_NAME_CHANGED);
+}
+
 /**
  * returns the process binary name
  */
-static ATTR_MALLOC gchar *c_get_process_name_INT_proc(lua_State *, pid_t);
-static ATTR_MALLOC gchar *c_get_process_name_INT_ps(lua_State *, pid_t);
-static ATTR_MALLOC gchar *c_get_process_owner_INT_proc(lua_State *, pid_t);
+static ATTR_MALLOC gchar *c_get_process_owner_INT_proc(pid_t);
+static ATTR_MALLOC gchar *read_window_process_name(WnckWindow *);
+static gchar *get_window_process_owner(WnckWindow *);
 
 int c_get_process_name(lua_State *lua)
 {
@@ -2548,143 +2886,300 @@ int c_get_process_name(lua_State *lua)
 		return 0;
 	}
 
-	WnckWindow *window = get_current_window();
+	gchar *cmdname = get_window_process_name(get_current_window());
 
-	if (window) {
-		pid_t pid = wnck_window_get_pid(window);
+	lua_pushstring(lua, cmdname ? cmdname : "");
+	g_free(cmdname);
+	return 1;
+}
 
-		if (pid != 0) {
-			gchar *cmdname = c_get_process_name_INT_proc(lua, pid);
-			if (!cmdname)
-				cmdname = c_get_process_name_INT_ps(lua, pid);
+/**
+ * Get the name of the process owning the window, or NULL if not known.
+ */
+gchar *get_window_process_name(WnckWindow *window)
+{
+	struct window_snapshot *snap = get_window_snapshot(window);
 
-			/* chop off any trailing LF */
-			gchar *lf = cmdname + strlen(cmdname) - 1;
-			if (lf >= cmdname && *lf == '\n')
-				*lf = 0;
+	if (!snap)
+		return read_window_process_name(window);
 
-			lua_pushstring(lua, cmdname ? cmdname : "");
-			g_free(cmdname);
-			return 1;
-		}
+	if (!snap->have_process_name) {
+		snap->process_name = read_window_process_name(window);
+		snap->have_process_name = TRUE;
 	}
 
-	lua_pushstring(lua, "");
-	return 1;
+	return g_strdup(snap->process_name);
 }
 
-static gchar *c_get_process_name_INT_proc(lua_State *lua, pid_t pid)
+static gchar *read_window_process_name(WnckWindow *window)
 {
-	/* 16 is fine for cmdname on Linux. Could be longer elsewhere, though. */
-	char cmd[1024], cmdname[1024];
-	FILE *cmdfp;
+	if (!window)
+		return NULL;
 
-	cmdname[0] = 0;
+	return get_process_info_name(get_window_pid(window));
+}
 
-	snprintf(cmd, sizeof(cmd), "/proc/%lu/comm", (unsigned long)pid);
-	cmdfp = fopen(cmd, "r");
-	if (cmdfp == NULL) {
-		if (errno != ENOENT && errno != EACCES) {
-			luaL_error(lua, "get_process_name: Failed to open \"%s\" (%d).", cmd, errno);
-		}
-		return NULL;
-	}
+int c_get_process_owner(lua_State *lua)
+{
+	if (!check_param_count(lua, "get_process_owner", 0)) {
+                return 0;
+        }
+
+
+	gchar *ownername = get_window_process_owner(get_current_window());
+
+	lua_pushstring(lua, ownername ? ownername : "");
+	g_free(ownername);
+	return 1;
+}
 
-	if (fgets(cmdname, sizeof(cmdname), cmdfp) == NULL) {
-		fclose(cmdfp);
-		luaL_error(lua, "get_process_name: Failed to read from \"%s\".", cmd);
+
+/**
+ * As get_window_process_name, for the name of the user running the process
+ */
+static gchar *get_window_process_owner(WnckWindow *window)
+{
+	struct window_snapshot *snap = get_window_snapshot(window);
+	pid_t pid = window ? get_window_pid(window) : 0;
+
+	if (pid == 0)
 		return NULL;
+
+	if (!snap)
+		return c_get_process_owner_INT_proc(pid);
+
+	if (!snap->have_process_owner) {
+		snap->process_owner = c_get_process_owner_INT_proc(pid);
+		snap->have_process_owner = TRUE;
 	}
 
-	fclose(cmdfp);
-	return g_strdup(cmdname);
+	return g_strdup(snap->process_owner);
 }
 
-static gchar *c_get_process_name_INT_ps(lua_State *lua, pid_t pid)
+
+/**
+ * returns the UID which the process is running as, or nil if not known
+ */
+int c_get_process_uid(lua_State *lua)
 {
-	char cmd[1024], cmdname[1024];
-	FILE *cmdfp;
+	if (!check_param_count(lua, "get_process_uid", 0)) {
+		return 0;
+	}
+
+	WnckWindow *window = get_current_window();
+	uid_t uid;
 
-	/* I'd like to use "ps ho comm c %lu" here.
-	 * Seems that FreeBSD ps outputs headers regardless.
-	 * (Tested using procps 'ps' with PS_PERSONALITY=bsd)
-	 */
-	snprintf(cmd, sizeof(cmd), "ps o comm c %lu | tail -n 1", (unsigned long)pid);
-	cmdfp = popen(cmd, "r");
-	if (cmdfp == NULL) {
-		luaL_error(lua, "get_process_name: Failed to run command \"%s\".", cmd);
+	if (window && get_process_info_uid(get_window_pid(window), &uid))
+		lua_pushinteger(lua, uid);
+	else
+		lua_pushnil(lua);
+	return 1;
+}
+
+
+/**
+ * returns the path of the process's executable
+ */
+int c_get_process_exe(lua_State *lua)
+{
+	if (!check_param_count(lua, "get_process_exe", 0)) {
 		return 0;
 	}
 
-	if (fgets(cmdname, sizeof(cmdname), cmdfp) == NULL) {
-		pclose(cmdfp);
-		luaL_error(lua, "get_process_name: Failed to read output from command \"%s\".", cmd);
+	WnckWindow *window = get_current_window();
+	gchar *exe = window ? get_process_info_exe(get_window_pid(window)) : NULL;
+
+	lua_pushstring(lua, exe ? exe : "");
+	g_free(exe);
+	return 1;
+}
+
+
+/**
+ * returns the process's arguments as a list
+ */
+int c_get_process_cmdline(lua_State *lua)
+{
+	if (!check_param_count(lua, "get_process_cmdline", 0)) {
 		return 0;
 	}
 
-	pclose(cmdfp);
-	return g_strdup(cmdname);
+	WnckWindow *window = get_current_window();
+	gchar **args = window ? get_process_info_cmdline(get_window_pid(window)) : NULL;
+	int count = args ? g_strv_length(args) : 0;
+
+	lua_createtable(lua, count, 0);
+	for (int i = 0; i < count; i++) {
+		lua_pushstring(lua, args[i]);
+		lua_rawseti(lua, -2, i + 1);
+	}
+
+	g_strfreev(args);
+	return 1;
 }
 
-int c_get_process_owner(lua_State *lua)
+
+/**
+ *
+ */
+static void set_string_field(lua_State *lua, const char *key, const char *value)
 {
-	if (!check_param_count(lua, "get_process_owner", 0)) {
-                return 0;
-        }
+	lua_pushstring(lua, value ? value : "");
+	lua_setfield(lua, -2, key);
+}
+
+
+/**
+ *
+ */
+static void set_boolean_field(lua_State *lua, const char *key, gboolean value)
+{
+	lua_pushboolean(lua, value);
+	lua_setfield(lua, -2, key);
+}
+
+
+/**
+ * Adds { x = …, y = …, width = …, height = … } as key
+ */
+static void set_geometry_field(lua_State *lua, const char *key, const int geometry[4])
+{
+	static const char *const names[] = { "x", "y", "width", "height" };
 
+	lua_createtable(lua, 0, 4);
+	for (int i = 0; i < 4; i++) {
+		lua_pushinteger(lua, geometry[i]);
+		lua_setfield(lua, -2, names[i]);
+	}
+	lua_setfield(lua, -2, key);
+}
+
+
+/**
+ * get_window_info()
+ * Returns most of what the get_* functions would, as one table; anything
+ * slow to find out is shared with the other scripts run for this event.
+ */
+int c_get_window_info(lua_State *lua)
+{
+	if (!check_param_count(lua, "get_window_info", 0)) {
+		return 0;
+	}
 
 	WnckWindow *window = get_current_window();
 
-	if (window) {
-		pid_t pid = wnck_window_get_pid(window);
+	if (!window) {
+		lua_pushnil(lua);
+		return 1;
+	}
 
-		if (pid != 0) {
-			gchar *ownername = c_get_process_owner_INT_proc(lua, pid);
-			lua_pushstring(lua, ownername ? ownername : "");
-			g_free(ownername);
-			return 1;
-		}
+	WnckApplication *application = wnck_window_get_application(window);
+	Window xid = wnck_window_get_xid(window);
+	int geometry[4], extents[4];
+	gchar *value;
+
+	lua_createtable(lua, 0, 24);
+
+	lua_pushinteger(lua, xid);
+	lua_setfield(lua, -2, "xid");
+	pid_t pid = get_window_pid(window);
+	lua_pushinteger(lua, pid);
+	lua_setfield(lua, -2, "pid");
+	uid_t uid;
+	if (get_process_info_uid(pid, &uid)) {
+		lua_pushinteger(lua, uid);
+		lua_setfield(lua, -2, "process_uid");
 	}
 
-	lua_pushstring(lua, "");
+	set_string_field(lua, "name", wnck_window_get_name(window));
+	set_boolean_field(lua, "has_name", wnck_window_has_name(window));
+	set_string_field(lua, "application_name",
+	                 application ? wnck_application_get_name(application) : NULL);
+	set_string_field(lua, "class", get_window_class_name(window));
+#ifdef HAVE_GTK3
+	set_string_field(lua, "class_instance_name", wnck_window_get_class_instance_name(window));
+	set_string_field(lua, "class_group_name", wnck_window_get_class_group_name(window));
+#endif
+	set_string_field(lua, "type", get_window_type_name(window));
+
+	value = my_wnck_get_string_property(xid, my_wnck_atom_get("WM_WINDOW_ROLE"), NULL);
+	set_string_field(lua, "role", value);
+	g_free(value);
+
+	value = get_window_process_name(window);
+	set_string_field(lua, "process_name", value);
+	g_free(value);
+
+	value = get_window_process_owner(window);
+	set_string_field(lua, "process_owner", value);
+	g_free(value);
+
+	get_window_geometry(window, geometry, geometry + 1, geometry + 2, geometry + 3);
+	set_geometry_field(lua, "geometry", geometry);
+	wnck_window_get_client_window_geometry(window, geometry, geometry + 1, geometry + 2, geometry + 3);
+	set_geometry_field(lua, "client_geometry", geometry);
+
+	get_window_frame_extents(window, extents);
+	lua_createtable(lua, 4, 0);
+	for (int i = 0; i < 4; i++) {
+		lua_pushinteger(lua, extents[i]);
+		lua_rawseti(lua, -2, i + 1);
+	}
+	lua_setfield(lua, -2, "frame_extents");
+
+	set_boolean_field(lua, "is_maximized", window_is_maximized(window, TRUE, TRUE));
+	set_boolean_field(lua, "is_maximized_vertically", window_is_maximized(window, TRUE, FALSE));
+	set_boolean_field(lua, "is_maximized_horizontally", window_is_maximized(window, FALSE, TRUE));
+	set_boolean_field(lua, "is_pinned", window_is_pinned(window));
+	set_boolean_field(lua, "fullscreen",
+	                  get_window_state(window, my_wnck_atom_get("_NET_WM_STATE_FULLSCREEN"),
+	                                   wnck_window_is_fullscreen(window)));
+	set_boolean_field(lua, "decorated", devilspie2_emulate || get_decorated(xid));
+
 	return 1;
 }
 
-static gchar *c_get_process_owner_INT_proc(lua_State *lua, pid_t pid)
+static gchar *c_get_process_owner_INT_proc(pid_t pid)
 {
-	char proc_comm_file[1024];
-	snprintf(proc_comm_file, sizeof(proc_comm_file), "/proc/%lu/comm", (unsigned long)pid);
-	struct stat info;
-	if (stat(proc_comm_file, &info) < 0){
-	    perror("stat");
+	uid_t uid;
+	if (!get_process_info_uid(pid, &uid))
 	    return NULL;
-	}
-	struct passwd *pw = getpwuid(info.st_uid);
-	if (pw != NULL){
-	    return g_strdup(pw->pw_name);
-	}
-	return NULL;
+	return get_user_name(uid);
 }
 
 
 
 /**
- *
+ * Reads a time (in ms) from the first parameter
  */
-int c_millisleep(lua_State *lua)
+static int get_wait_time(lua_State *lua, const char *func, int index)
 {
-	if (!check_param_count(lua, "millisleep", 1)) {
+	if (lua_type(lua, index) != LUA_TNUMBER) {
+		luaL_error(lua, "%s: %s", func, number_expected_as_indata_error);
 		return 0;
 	}
-	if (lua_type(lua, 1) != LUA_TNUMBER) {
-		luaL_error(lua, "millisleep: %s",
-		           number_expected_as_indata_error);
+
+	int time = lua_tonumber(lua, index);
+	if (time < 0) {
+		luaL_error(lua, _("%s: time %d out of range"), func, time);
 		return 0;
 	}
 
-	int time = lua_tonumber(lua, 1);
-	if (time < 1 || time > 1000) {
-		luaL_error(lua, _("millisleep: time %d out of range (1..1000)"), time);
+	return time;
+}
+
+
+/**
+ * Lets the main loop carry on while the script sleeps, if it can be
+ * suspended; otherwise, blocks (for up to a second)
+ */
+static int sleep_script(lua_State *lua, const char *func, int time)
+{
+	if (script_can_wait(lua))
+		return script_wait(lua, SCRIPT_WAIT_SLEEP, time, None, None);
+
+	if (time > 1000) {
+		luaL_error(lua, _("%s: can't wait here for more than 1000ms"), func);
 		return 0;
 	}
 
@@ -2704,6 +3199,124 @@ int c_millisleep(lua_State *lua)
 }
 
 
+/**
+ *
+ */
+int c_sleep(lua_State *lua)
+{
+	if (!check_param_count(lua, "sleep", 1)) {
+		return 0;
+	}
+
+	return sleep_script(lua, "sleep", get_wait_time(lua, "sleep", 1));
+}
+
+
+/**
+ * As sleep(), but limited to 1..1000ms as it always has been
+ */
+int c_millisleep(lua_State *lua)
+{
+	if (!check_param_count(lua, "millisleep", 1)) {
+		return 0;
+	}
+	if (lua_type(lua, 1) != LUA_TNUMBER) {
+		luaL_error(lua, "millisleep: %s",
+		           number_expected_as_indata_error);
+		return 0;
+	}
+
+	int time = lua_tonumber(lua, 1);
+	if (time < 1 || time > 1000) {
+		luaL_error(lua, _("millisleep: time %d out of range (1..1000)"), time);
+		return 0;
+	}
+
+	return sleep_script(lua, "millisleep", time);
+}
+
+
+/**
+ * wait_for_property(name, timeout)
+ * Returns the property's value as soon as the window has it, or nil if it
+ * hasn't been set within the timeout (in ms)
+ */
+int c_wait_for_property(lua_State *lua)
+{
+	if (!check_param_count(lua, "wait_for_property", 2)) {
+		return 0;
+	}
+	if (lua_type(lua, 1) != LUA_TSTRING) {
+		luaL_error(lua, "wait_for_property: %s", string_expected_as_indata_error);
+		return 0;
+	}
+
+	int time = get_wait_time(lua, "wait_for_property", 2);
+	WnckWindow *window = get_current_window();
+
+	if (!window) {
+		lua_pushnil(lua);
+		return 1;
+	}
+
+	Window xid = wnck_window_get_xid(window);
+	Atom atom = my_wnck_atom_get(lua_tostring(lua, 1));
+	gchar *value = my_wnck_get_string_property(xid, atom, NULL);
+
+	if (value || time == 0) {
+		if (value)
+			lua_pushstring(lua, value);
+		else
+			lua_pushnil(lua);
+		g_free(value);
+		return 1;
+	}
+
+	if (!script_can_wait(lua)) {
+		luaL_error(lua, _("%s: can't wait here"), "wait_for_property");
+		return 0;
+	}
+
+	return script_wait(lua, SCRIPT_WAIT_PROPERTY, time, xid, atom);
+}
+
+
+/**
+ * wait_for_mapped(timeout)
+ * Returns true as soon as the window is mapped, or false if it hasn't
+ * been within the timeout (in ms)
+ */
+int c_wait_for_mapped(lua_State *lua)
+{
+	if (!check_param_count(lua, "wait_for_mapped", 1)) {
+		return 0;
+	}
+
+	int time = get_wait_time(lua, "wait_for_mapped", 1);
+	WnckWindow *window = get_current_window();
+
+	if (!window) {
+		lua_pushboolean(lua, FALSE);
+		return 1;
+	}
+
+	Window xid = wnck_window_get_xid(window);
+	gboolean mapped = watch_window_mapping(xid);
+
+	if (mapped || time == 0) {
+		lua_pushboolean(lua, mapped);
+		return 1;
+	}
+
+	if (!script_can_wait(lua)) {
+		luaL_error(lua, _("%s: can't wait here"), "wait_for_mapped");
+		return 0;
+	}
+
+	return script_wait(lua, SCRIPT_WAIT_MAPPED, time, xid, None);
+}
+
+
 /*
  * Devilspie:
 
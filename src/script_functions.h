@@ -74,9 +74,14 @@ int c_unstick_window(lua_State *lua);
 
 int c_close_window(lua_State *lua);
 
+extern WnckHandle *my_wnck_handle;
+
 void set_current_window(WnckWindow *window);
 WnckWindow *get_current_window();
 
+void begin_window_snapshot(WnckWindow *window);
+void end_window_snapshot(void);
+
 int c_set_adjust_for_decoration(lua_State *lua);
 
 int c_get_window_geometry(lua_State *lua);
@@ -102,6 +107,7 @@ int c_set_on_top(lua_State *lua);
 int c_set_on_bottom(lua_State *lua);
 
 int c_get_window_type(lua_State *lua);
+const char *get_window_type_name(WnckWindow *window);
 
 // these two require GTK 3 or later
 int c_get_class_instance_name(lua_State *lua);
@@ -110,11 +116,13 @@ int c_get_class_group_name(lua_State *lua);
 int c_get_window_property(lua_State *lua);
 int c_window_property_is_utf8(lua_State *lua);
 int c_get_window_property_full(lua_State *lua);
+int c_get_window_properties(lua_State *lua);
 int c_get_window_role(lua_State *lua);
 
 int c_get_window_xid(lua_State *lua);
 
 int c_get_window_class(lua_State *lua);
+const char *get_window_class_name(WnckWindow *window);
 
 int c_set_window_property(lua_State *lua);
 int c_delete_window_property(lua_State *lua);
@@ -139,12 +147,30 @@ int c_get_monitor_geometry(lua_State *lua);
 int c_xy(lua_State *lua);
 int c_xywh(lua_State *lua);
 
+int c_begin_layout(lua_State *lua);
+int c_commit_layout(lua_State *lua);
+
 int c_on_geometry_changed(lua_State *lua);
 
+int c_on_window_open(lua_State *lua);
+int c_on_window_close(lua_State *lua);
+int c_on_focus(lua_State *lua);
+int c_on_blur(lua_State *lua);
+int c_on_name_change(lua_State *lua);
+
 int c_get_process_name(lua_State *lua);
+gchar *get_window_process_name(WnckWindow *window);
 
 int c_get_process_owner(lua_State *lua);
+int c_get_process_uid(lua_State *lua);
+int c_get_process_exe(lua_State *lua);
+int c_get_process_cmdline(lua_State *lua);
+
+int c_get_window_info(lua_State *lua);
 
+int c_sleep(lua_State *lua);
 int c_millisleep(lua_State *lua);
+int c_wait_for_property(lua_State *lua);
+int c_wait_for_mapped(lua_State *lua);
 
 #endif /*__HEADER_SCRIPT_FUNCTIONS_*/
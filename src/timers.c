@@ -0,0 +1,450 @@
+/**
+ *	This file is part of devilspie2
+ *	Copyright (C) 2026 devilspie2 developers
+ *
+ *	devilspie2 is free software: you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as published
+ *	by the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	devilspie2 is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with devilspie2.
+ *	If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+
+#define WNCK_I_KNOW_THIS_IS_UNSTABLE
+#include <libwnck/libwnck.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include "intl.h"
+#include "script.h"
+#include "script_functions.h"
+#include "error_strings.h"
+
+#include "timers.h"
+
+
+/**
+ * Timers set by after() and every(), kept in a hierarchical timer wheel:
+ * level 0 has a slot per tick for the next TIMER_SLOTS ticks, and each
+ * level above has slots TIMER_SLOTS times as long, whose timers are
+ * moved down a level when their slot comes round. Adding and cancelling
+ * a timer take constant time, however many there are, and a single
+ * GSource wakes up only when there's something to do.
+ */
+#define TIMER_TICK_MS   10
+#define TIMER_BITS      6
+#define TIMER_SLOTS     (1 << TIMER_BITS)
+#define TIMER_MASK      (TIMER_SLOTS - 1)
+#define TIMER_LEVELS    4
+#define TIMER_MAX_TICKS (((guint64)1 << (TIMER_BITS * TIMER_LEVELS)) - 1)
+
+struct timer {
+	guint id;
+	lua_State *lua;
+	int ref;             /* the function */
+	WnckWindow *window;  /* cancelled when it closes, if set */
+	guint64 expires;     /* tick */
+	guint64 interval;    /* ticks, or 0 if not repeating */
+	GQueue *slot;
+	GList *link;
+};
+
+static GQueue wheel[TIMER_LEVELS][TIMER_SLOTS];
+static guint64 wheel_tick = 0;      /* the last tick which has been run */
+static gint64 wheel_start = 0;      /* monotonic time of tick 0 */
+static GSource *wheel_source = NULL;
+static gboolean dispatching = FALSE;
+
+static GHashTable *timers = NULL;        /* id → struct timer */
+static GHashTable *window_timers = NULL; /* window → GSList of struct timer */
+static guint last_timer_id = 0;
+
+
+/**
+ *
+ */
+static guint64 current_tick(void)
+{
+	return (g_get_monotonic_time() - wheel_start) / (TIMER_TICK_MS * 1000);
+}
+
+
+/**
+ * Puts the timer in the slot for its expiry time, relative to wheel_tick.
+ * (One moved down to the current tick's slot is run with the rest.) One
+ * which expires beyond the top level goes in the furthest slot there, and
+ * is put back in the same way when that slot is moved down.
+ */
+static void wheel_insert(struct timer *timer)
+{
+	guint64 delta, at;
+	int level = 0;
+
+	if (timer->expires < wheel_tick)
+		timer->expires = wheel_tick;
+	at = MIN(timer->expires, wheel_tick + TIMER_MAX_TICKS);
+	delta = at - wheel_tick;
+
+	while (level < TIMER_LEVELS - 1 &&
+	       delta >= ((guint64)1 << (TIMER_BITS * (level + 1))))
+		level++;
+
+	timer->slot = &wheel[level][(at >> (TIMER_BITS * level)) & TIMER_MASK];
+	g_queue_push_tail(timer->slot, timer);
+	timer->link = timer->slot->tail;
+}
+
+
+/**
+ *
+ */
+static void wheel_remove(struct timer *timer)
+{
+	if (timer->slot) {
+		g_queue_delete_link(timer->slot, timer->link);
+		timer->slot = NULL;
+		timer->link = NULL;
+	}
+}
+
+
+/**
+ * Moves the timers in a slot down to where they now belong; returns the
+ * slot's index
+ */
+static int cascade(int level)
+{
+	int index = (wheel_tick >> (TIMER_BITS * level)) & TIMER_MASK;
+	GQueue *slot = &wheel[level][index];
+	struct timer *timer;
+
+	while ((timer = g_queue_pop_head(slot))) {
+		timer->slot = NULL;
+		wheel_insert(timer);
+	}
+
+	return index;
+}
+
+
+/**
+ * The first tick at which something needs doing (a timer expiring or a
+ * slot to be moved down), or 0 if there are no timers
+ */
+static guint64 next_wheel_tick(void)
+{
+	guint64 next = 0;
+
+	if (!timers || g_hash_table_size(timers) == 0)
+		return 0;
+
+	for (int level = 0; level < TIMER_LEVELS; level++) {
+		int shift = TIMER_BITS * level;
+
+		for (guint64 k = 1; k <= TIMER_SLOTS; k++) {
+			guint64 tick = ((wheel_tick >> shift) + k) << shift;
+
+			if (next && tick >= next)
+				break;
+			if (!g_queue_is_empty(&wheel[level][(tick >> shift) & TIMER_MASK])) {
+				next = tick;
+				break;
+			}
+		}
+	}
+
+	return next;
+}
+
+
+/**
+ * Moves the wheel on towards now without going through the ticks one by
+ * one, as far as nothing needs doing
+ */
+static void skip_idle_ticks(guint64 now)
+{
+	guint64 next = next_wheel_tick();
+
+	if (!next || next > now)
+		wheel_tick = MAX(wheel_tick, now);
+	else if (next - 1 > wheel_tick)
+		wheel_tick = next - 1;
+}
+
+
+/**
+ *
+ */
+static void schedule_wheel(void)
+{
+	guint64 next = next_wheel_tick();
+
+	if (wheel_source)
+		g_source_set_ready_time(wheel_source,
+		                        next ? wheel_start + (gint64)next * TIMER_TICK_MS * 1000 : -1);
+}
+
+
+/**
+ *
+ */
+static void free_timer(struct timer *timer)
+{
+	wheel_remove(timer);
+
+	if (timer->window) {
+		GSList *list = g_hash_table_lookup(window_timers, timer->window);
+
+		list = g_slist_remove(list, timer);
+		// steal so that replacing the value doesn't free the list
+		g_hash_table_steal(window_timers, timer->window);
+		if (list)
+			g_hash_table_insert(window_timers, timer->window, list);
+	}
+
+	g_hash_table_remove(timers, GUINT_TO_POINTER(timer->id));
+	luaL_unref(timer->lua, LUA_REGISTRYINDEX, timer->ref);
+	g_free(timer);
+}
+
+
+/**
+ * Runs one expired timer. A repeating one is put back first, so that it
+ * can cancel itself.
+ */
+static void run_timer(struct timer *timer)
+{
+	lua_State *lua = timer->lua;
+	WnckWindow *window = timer->window;
+
+	lua_rawgeti(lua, LUA_REGISTRYINDEX, timer->ref);
+
+	if (timer->interval) {
+		// if it has fallen behind, don't try to catch up
+		timer->expires = MAX(timer->expires + timer->interval, wheel_tick + 1);
+		wheel_insert(timer);
+	} else {
+		free_timer(timer);
+	}
+
+	run_script_function(lua, window);
+}
+
+
+/**
+ * Catches up with the clock, running whatever has expired
+ */
+static gboolean wheel_dispatch(GSource *source G_GNUC_UNUSED,
+                               GSourceFunc callback G_GNUC_UNUSED,
+                               gpointer data G_GNUC_UNUSED)
+{
+	guint64 now = current_tick();
+
+	dispatching = TRUE;
+
+	for (;;) {
+		skip_idle_ticks(now);
+		if (wheel_tick >= now)
+			break;
+
+		wheel_tick++;
+
+		// at the start of each round of a level, the next level's slot is due
+		int index = wheel_tick & TIMER_MASK;
+		for (int level = 1; index == 0 && level < TIMER_LEVELS; level++)
+			index = cascade(level);
+
+		GQueue *slot = &wheel[0][wheel_tick & TIMER_MASK];
+		struct timer *timer;
+
+		while ((timer = g_queue_pop_head(slot))) {
+			timer->slot = NULL;
+			run_timer(timer);
+		}
+	}
+
+	dispatching = FALSE;
+
+	schedule_wheel();
+	return TRUE;
+}
+
+
+static GSourceFuncs wheel_source_funcs = {
+	NULL, NULL, wheel_dispatch, NULL, NULL, NULL
+};
+
+
+/**
+ * Adds a timer for the function at index 2, bound to the current window
+ */
+static int add_timer(lua_State *lua, const char *func, gboolean repeat)
+{
+	if (lua_gettop(lua) != 2) {
+		luaL_error(lua, "%s: %s", func, num_indata_expected_errors[2]);
+		return 0;
+	}
+	if (lua_type(lua, 1) != LUA_TNUMBER) {
+		luaL_error(lua, "%s: %s", func, number_expected_as_indata_error);
+		return 0;
+	}
+	if (lua_type(lua, 2) != LUA_TFUNCTION) {
+		luaL_error(lua, "%s: %s", func, "function expected");
+		return 0;
+	}
+
+	lua_State *state = get_script_state(lua);
+	if (!state) {
+		luaL_error(lua, _("%s: timers can only be set by window scripts"), func);
+		return 0;
+	}
+
+	// checked before it's converted, which is undefined if it won't fit
+	lua_Number time = lua_tonumber(lua, 1);
+	if (!(time >= 0 && time <= G_MAXINT) || (repeat && time < TIMER_TICK_MS)) {
+		luaL_error(lua, _("%s: time %f out of range"), func, time);
+		return 0;
+	}
+	int ms = time;
+
+	if (!timers) {
+		timers = g_hash_table_new(NULL, NULL);
+		window_timers = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_slist_free);
+		for (int level = 0; level < TIMER_LEVELS; level++)
+			for (int i = 0; i < TIMER_SLOTS; i++)
+				g_queue_init(&wheel[level][i]);
+		wheel_start = g_get_monotonic_time();
+		wheel_source = g_source_new(&wheel_source_funcs, sizeof(GSource));
+		g_source_attach(wheel_source, NULL);
+	}
+
+	// so that the new timer's slot is worked out from the present
+	if (!dispatching)
+		skip_idle_ticks(current_tick());
+
+	struct timer *timer = g_new0(struct timer, 1);
+	guint64 ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+	timer->id = ++last_timer_id;
+	timer->lua = state;
+	lua_pushvalue(lua, 2);
+	timer->ref = luaL_ref(lua, LUA_REGISTRYINDEX);
+	timer->window = get_current_window();
+	timer->expires = current_tick() + (ticks ? ticks : 1);
+	timer->interval = repeat ? ticks : 0;
+
+	g_hash_table_insert(timers, GUINT_TO_POINTER(timer->id), timer);
+	if (timer->window) {
+		GSList *list = g_hash_table_lookup(window_timers, timer->window);
+		g_hash_table_steal(window_timers, timer->window);
+		g_hash_table_insert(window_timers, timer->window, g_slist_prepend(list, timer));
+	}
+
+	wheel_insert(timer);
+	schedule_wheel();
+
+	lua_pushinteger(lua, timer->id);
+	return 1;
+}
+
+
+/**
+ * after(ms, function)
+ * Calls the function once, after the time, with the current window as it
+ * is now. Returns the timer's ID, for cancel_timer().
+ */
+int c_after(lua_State *lua)
+{
+	return add_timer(lua, "after", FALSE);
+}
+
+
+/**
+ * every(ms, function)
+ * As after(), but calls the function repeatedly until cancelled
+ */
+int c_every(lua_State *lua)
+{
+	return add_timer(lua, "every", TRUE);
+}
+
+
+/**
+ * cancel_timer(id)
+ * Returns whether the timer was still pending
+ */
+int c_cancel_timer(lua_State *lua)
+{
+	if (lua_gettop(lua) != 1) {
+		luaL_error(lua, "cancel_timer: %s", num_indata_expected_errors[1]);
+		return 0;
+	}
+	if (lua_type(lua, 1) != LUA_TNUMBER) {
+		luaL_error(lua, "cancel_timer: %s", number_expected_as_indata_error);
+		return 0;
+	}
+
+	guint id = lua_tonumber(lua, 1);
+	struct timer *timer = timers ? g_hash_table_lookup(timers, GUINT_TO_POINTER(id)) : NULL;
+
+	if (timer) {
+		free_timer(timer);
+		schedule_wheel();
+	}
+
+	lua_pushboolean(lua, timer != NULL);
+	return 1;
+}
+
+
+/**
+ * Cancels the window's timers (when it's closed)
+ */
+void cancel_window_timers(WnckWindow *window)
+{
+	GSList *list = window_timers ? g_hash_table_lookup(window_timers, window) : NULL;
+
+	if (!list)
+		return;
+
+	// free_timer changes the list, so work from a copy
+	list = g_slist_copy(list);
+	for (GSList *item = list; item; item = item->next)
+		free_timer(item->data);
+	g_slist_free(list);
+	schedule_wheel();
+}
+
+
+/**
+ * Cancels all of the timers set in this Lua state (before closing it)
+ */
+void clear_timers(lua_State *lua)
+{
+	GHashTableIter iter;
+	gpointer data;
+	GSList *list = NULL;
+
+	if (!timers)
+		return;
+
+	g_hash_table_iter_init(&iter, timers);
+	while (g_hash_table_iter_next(&iter, NULL, &data))
+		if (((struct timer *)data)->lua == lua)
+			list = g_slist_prepend(list, data);
+
+	for (GSList *item = list; item; item = item->next)
+		free_timer(item->data);
+	g_slist_free(list);
+	schedule_wheel();
+}
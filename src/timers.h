@@ -0,0 +1,32 @@
+/**
+ *	This file is part of devilspie2
+ *	Copyright (C) 2026 devilspie2 developers
+ *
+ *	devilspie2 is free software: you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as published
+ *	by the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	devilspie2 is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with devilspie2.
+ *	If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HEADER_TIMERS_
+#define __HEADER_TIMERS_
+
+/**
+ *
+ */
+int c_after(lua_State *lua);
+int c_every(lua_State *lua);
+int c_cancel_timer(lua_State *lua);
+
+void cancel_window_timers(WnckWindow *window);
+void clear_timers(lua_State *lua);
+
+#endif /*__HEADER_TIMERS_*/
@@ -0,0 +1,611 @@
+/**
+ *	This file is part of devilspie2
+ *	Copyright (C) 2026 devilspie2 developers
+ *
+ *	devilspie2 is free software: you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as published
+ *	by the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	devilspie2 is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with devilspie2.
+ *	If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+#include <string.h>
+
+#define WNCK_I_KNOW_THIS_IS_UNSTABLE
+#include <libwnck/libwnck.h>
+
+#include <X11/Xlib.h>
+#include <gdk/gdk.h>
+#include <gdk/gdkx.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include "script.h"
+#include "script_functions.h"
+#include "window_object.h"
+#include "xutils.h"
+#include "error_strings.h"
+
+#include "window_index.h"
+
+
+/**
+ * What the index knows about one window. It's updated from libwnck's
+ * signals, so that queries needn't ask the X server about every window.
+ * The role (which needs a round trip) and the monitor are only worked out
+ * when a query asks for them.
+ */
+struct indexed_window {
+	WnckWindow *window;
+	gchar *class;
+	gchar *role;    /* NULL if not known */
+	int pid;
+	gboolean have_pid; /* FALSE until asked about if there's no _NET_WM_PID */
+	int workspace;  /* index, or -1 if on all workspaces (or none) */
+	int monitor;    /* MONITOR_NONE if not known */
+};
+
+/**
+ * Each index maps a key to a set of struct indexed_window
+ */
+static GHashTable *windows = NULL;      /* WnckWindow * → struct indexed_window */
+static GHashTable *by_class = NULL;     /* class → set */
+static GHashTable *by_role = NULL;      /* role → set */
+static GHashTable *by_pid = NULL;       /* pid → set */
+static GHashTable *by_workspace = NULL; /* workspace + 1 → set */
+static GHashTable *by_monitor = NULL;   /* monitor + 1 → set */
+
+static guint monitor_serial = 0;
+
+
+/**
+ *
+ */
+static void index_insert(GHashTable *index, gpointer key, struct indexed_window *entry)
+{
+	GHashTable *set = g_hash_table_lookup(index, key);
+
+	if (!set) {
+		set = g_hash_table_new(NULL, NULL);
+		// string keys belong to the index, not to whichever window came first
+		g_hash_table_insert(index, (index == by_class || index == by_role) ? g_strdup(key) : key, set);
+	}
+
+	g_hash_table_add(set, entry);
+}
+
+
+/**
+ *
+ */
+static void index_remove(GHashTable *index, gconstpointer key, struct indexed_window *entry)
+{
+	GHashTable *set = g_hash_table_lookup(index, key);
+
+	if (set) {
+		g_hash_table_remove(set, entry);
+		if (g_hash_table_size(set) == 0)
+			g_hash_table_remove(index, key);
+	}
+}
+
+
+/**
+ *
+ */
+static GHashTable *index_lookup(GHashTable *index, gconstpointer key)
+{
+	return index ? g_hash_table_lookup(index, key) : NULL;
+}
+
+
+/**
+ *
+ */
+static void update_class(struct indexed_window *entry)
+{
+	if (entry->class) {
+		index_remove(by_class, entry->class, entry);
+		g_free(entry->class);
+	}
+
+	entry->class = g_strdup(get_window_class_name(entry->window));
+	index_insert(by_class, entry->class, entry);
+}
+
+
+/**
+ *
+ */
+static void forget_role(struct indexed_window *entry)
+{
+	if (entry->role) {
+		index_remove(by_role, entry->role, entry);
+		g_free(entry->role);
+		entry->role = NULL;
+	}
+}
+
+
+/**
+ *
+ */
+static void update_role(struct indexed_window *entry)
+{
+	forget_role(entry);
+
+	entry->role = my_wnck_get_string_property(wnck_window_get_xid(entry->window),
+	                                          my_wnck_atom_get("WM_WINDOW_ROLE"), NULL);
+	if (!entry->role)
+		entry->role = g_strdup("");
+	index_insert(by_role, entry->role, entry);
+}
+
+
+/**
+ *
+ */
+static void update_workspace(struct indexed_window *entry)
+{
+	WnckWorkspace *workspace = wnck_window_get_workspace(entry->window);
+
+	index_remove(by_workspace, GINT_TO_POINTER(entry->workspace + 1), entry);
+	entry->workspace = workspace && !wnck_window_is_pinned(entry->window)
+	                   ? wnck_workspace_get_number(workspace) : -1;
+	index_insert(by_workspace, GINT_TO_POINTER(entry->workspace + 1), entry);
+}
+
+
+/**
+ *
+ */
+static void forget_monitor(struct indexed_window *entry)
+{
+	if (entry->monitor != MONITOR_NONE) {
+		index_remove(by_monitor, GINT_TO_POINTER(entry->monitor + 1), entry);
+		entry->monitor = MONITOR_NONE;
+	}
+}
+
+
+/**
+ *
+ */
+static void update_monitor(struct indexed_window *entry)
+{
+	forget_monitor(entry);
+	entry->monitor = get_monitor_index_geometry(entry->window, NULL, NULL);
+	index_insert(by_monitor, GINT_TO_POINTER(entry->monitor + 1), entry);
+}
+
+
+/**
+ *
+ */
+static void class_changed_cb(WnckWindow *window G_GNUC_UNUSED, struct indexed_window *entry)
+{
+	update_class(entry);
+}
+
+
+/**
+ *
+ */
+static void role_changed_cb(WnckWindow *window G_GNUC_UNUSED, struct indexed_window *entry)
+{
+	forget_role(entry);
+}
+
+
+/**
+ *
+ */
+static void workspace_changed_cb(WnckWindow *window G_GNUC_UNUSED, struct indexed_window *entry)
+{
+	update_workspace(entry);
+}
+
+
+/**
+ *
+ */
+static void geometry_changed_cb(WnckWindow *window G_GNUC_UNUSED, struct indexed_window *entry)
+{
+	forget_monitor(entry);
+}
+
+
+/**
+ *
+ */
+static GHashTable *new_index(GHashFunc hash, GEqualFunc equal, GDestroyNotify key_destroy)
+{
+	return g_hash_table_new_full(hash, equal, key_destroy, (GDestroyNotify)g_hash_table_destroy);
+}
+
+
+/**
+ * Adds a window (when it's opened)
+ */
+void window_index_add(WnckWindow *window)
+{
+	if (!windows) {
+		windows = g_hash_table_new(NULL, NULL);
+		by_class = new_index(g_str_hash, g_str_equal, g_free);
+		by_role = new_index(g_str_hash, g_str_equal, g_free);
+		by_pid = new_index(NULL, NULL, NULL);
+		by_workspace = new_index(NULL, NULL, NULL);
+		by_monitor = new_index(NULL, NULL, NULL);
+		monitor_serial = get_monitor_layout_serial();
+	}
+
+	if (g_hash_table_contains(windows, window))
+		return;
+
+	struct indexed_window *entry = g_new0(struct indexed_window, 1);
+
+	entry->window = window;
+	entry->pid = wnck_window_get_pid(window);
+	entry->have_pid = entry->pid != 0;
+	entry->workspace = -1;
+	entry->monitor = MONITOR_NONE;
+	g_hash_table_insert(windows, window, entry);
+	index_insert(by_pid, GINT_TO_POINTER(entry->pid), entry);
+	update_class(entry);
+	update_workspace(entry);
+
+	g_signal_connect(window, "class-changed", (GCallback)class_changed_cb, entry);
+	g_signal_connect(window, "role-changed", (GCallback)role_changed_cb, entry);
+	g_signal_connect(window, "workspace-changed", (GCallback)workspace_changed_cb, entry);
+	g_signal_connect(window, "geometry-changed", (GCallback)geometry_changed_cb, entry);
+}
+
+
+/**
+ * Removes a window (when it's closed)
+ */
+void window_index_remove(WnckWindow *window)
+{
+	struct indexed_window *entry = windows ? g_hash_table_lookup(windows, window) : NULL;
+
+	if (!entry)
+		return;
+
+	g_signal_handlers_disconnect_by_data(window, entry);
+
+	forget_role(entry);
+	forget_monitor(entry);
+	index_remove(by_class, entry->class, entry);
+	index_remove(by_pid, GINT_TO_POINTER(entry->pid), entry);
+	index_remove(by_workspace, GINT_TO_POINTER(entry->workspace + 1), entry);
+	g_hash_table_remove(windows, window);
+
+	g_free(entry->class);
+	g_free(entry);
+}
+
+
+/**
+ * Asks the X server for the PIDs of the windows which don't have
+ * _NET_WM_PID, all in one request
+ */
+static void fill_in_pids(void)
+{
+	GArray *xids = g_array_new(FALSE, FALSE, sizeof(Window));
+	GHashTableIter iter;
+	gpointer data;
+
+	g_hash_table_iter_init(&iter, windows);
+	while (g_hash_table_iter_next(&iter, NULL, &data)) {
+		struct indexed_window *entry = data;
+
+		if (!entry->have_pid) {
+			Window xid = wnck_window_get_xid(entry->window);
+			g_array_append_val(xids, xid);
+		}
+	}
+
+	if (xids->len == 0) {
+		g_array_free(xids, TRUE);
+		return;
+	}
+
+	prefetch_client_pids((Window *)xids->data, xids->len);
+	g_array_free(xids, TRUE);
+
+	g_hash_table_iter_init(&iter, windows);
+	while (g_hash_table_iter_next(&iter, NULL, &data)) {
+		struct indexed_window *entry = data;
+
+		if (!entry->have_pid) {
+			index_remove(by_pid, GINT_TO_POINTER(entry->pid), entry);
+			entry->pid = get_window_pid(entry->window);
+			entry->have_pid = TRUE;
+			index_insert(by_pid, GINT_TO_POINTER(entry->pid), entry);
+		}
+	}
+}
+
+
+/**
+ * Works out the PIDs, roles and/or monitors which aren't known yet. Monitor
+ * numbers are only as good as the monitor layout which they were worked
+ * out from, so they're all redone if that has changed.
+ */
+static void fill_in_index(gboolean pids, gboolean roles, gboolean monitors)
+{
+	guint serial = get_monitor_layout_serial();
+	gboolean layout_changed = monitors && serial != monitor_serial;
+	GHashTableIter iter;
+	gpointer data;
+
+	if (pids)
+		fill_in_pids();
+
+	if (monitors)
+		monitor_serial = serial;
+
+	g_hash_table_iter_init(&iter, windows);
+	while (g_hash_table_iter_next(&iter, NULL, &data)) {
+		struct indexed_window *entry = data;
+
+		if (roles && !entry->role)
+			update_role(entry);
+		if (monitors && (layout_changed || entry->monitor == MONITOR_NONE))
+			update_monitor(entry);
+	}
+}
+
+
+/**
+ * A query: which fields are constrained, and to what
+ */
+struct window_query {
+	const char *class;
+	const char *role;
+	gboolean have_pid, have_workspace, have_monitor;
+	int pid, workspace, monitor;
+};
+
+
+/**
+ *
+ */
+static gboolean query_matches(const struct window_query *query, const struct indexed_window *entry)
+{
+	return (!query->class || !g_strcmp0(query->class, entry->class)) &&
+	       (!query->role || !g_strcmp0(query->role, entry->role)) &&
+	       (!query->have_pid || query->pid == entry->pid) &&
+	       (!query->have_workspace || query->workspace == entry->workspace || entry->workspace < 0) &&
+	       (!query->have_monitor || query->monitor == entry->monitor);
+}
+
+
+/**
+ * Reads the query table at index 1
+ */
+static void read_query(lua_State *lua, struct window_query *query)
+{
+	memset(query, 0, sizeof(*query));
+
+	lua_pushnil(lua);
+	while (lua_next(lua, 1)) {
+		const char *key = lua_type(lua, -2) == LUA_TSTRING ? lua_tostring(lua, -2) : "";
+		int type = lua_type(lua, -1);
+
+		if (!strcmp(key, "class") || !strcmp(key, "role")) {
+			if (type != LUA_TSTRING)
+				luaL_error(lua, "find_windows: %s: %s", key, string_expected_as_indata_error);
+			if (*key == 'c')
+				query->class = lua_tostring(lua, -1);
+			else
+				query->role = lua_tostring(lua, -1);
+		} else if (!strcmp(key, "pid") || !strcmp(key, "workspace") || !strcmp(key, "monitor")) {
+			if (type != LUA_TNUMBER)
+				luaL_error(lua, "find_windows: %s: %s", key, number_expected_as_indata_error);
+			int value = lua_tonumber(lua, -1);
+			switch (*key) {
+			case 'p':
+				query->pid = value;
+				query->have_pid = TRUE;
+				break;
+			case 'w':
+				// numbered from 1 in scripts
+				query->workspace = value - 1;
+				query->have_workspace = TRUE;
+				break;
+			default:
+				query->monitor = value - 1;
+				query->have_monitor = TRUE;
+			}
+		} else {
+			luaL_error(lua, "find_windows: unknown key \"%s\"", key);
+		}
+
+		lua_pop(lua, 1);
+	}
+}
+
+
+/**
+ *
+ */
+static gboolean in_set(GHashTable *set, struct indexed_window *entry)
+{
+	return set && g_hash_table_contains(set, entry);
+}
+
+
+/**
+ * Returns the windows which match the query, bottom-most first. The
+ * smallest of the indexed sets for the constrained fields is filtered by
+ * the others; an empty query matches everything.
+ */
+static GSList *find_windows(const struct window_query *query)
+{
+	GHashTable *sets[6];
+	GHashTable *candidates[2] = { NULL, NULL };
+	guint candidate_count;
+	int count = 0;
+
+	if (!windows)
+		return NULL;
+
+	fill_in_index(query->have_pid, query->role != NULL, query->have_monitor);
+
+	if (query->class)
+		sets[count++] = index_lookup(by_class, query->class);
+	if (query->role)
+		sets[count++] = index_lookup(by_role, query->role);
+	if (query->have_pid)
+		sets[count++] = index_lookup(by_pid, GINT_TO_POINTER(query->pid));
+	if (query->have_monitor)
+		sets[count++] = index_lookup(by_monitor, GINT_TO_POINTER(query->monitor + 1));
+
+	candidates[0] = windows;
+	candidate_count = g_hash_table_size(windows);
+
+	for (int i = 0; i < count; i++) {
+		if (!sets[i])
+			return NULL;
+		if (g_hash_table_size(sets[i]) < candidate_count) {
+			candidates[0] = sets[i];
+			candidate_count = g_hash_table_size(sets[i]);
+		}
+	}
+
+	// windows on all workspaces match any workspace, so they go along with
+	// the workspace's own
+	if (query->have_workspace) {
+		GHashTable *own = index_lookup(by_workspace, GINT_TO_POINTER(query->workspace + 1));
+		GHashTable *all = index_lookup(by_workspace, GINT_TO_POINTER(0));
+		guint size = (own ? g_hash_table_size(own) : 0) + (all ? g_hash_table_size(all) : 0);
+
+		if (size == 0)
+			return NULL;
+		if (size < candidate_count) {
+			candidates[0] = own;
+			candidates[1] = all;
+		}
+	}
+
+	// keep the matches in stacking order
+	WnckScreen *screen = wnck_handle_get_default_screen(my_wnck_handle);
+	GSList *result = NULL;
+
+	for (GList *list = screen ? wnck_screen_get_windows_stacked(screen) : NULL; list; list = list->next) {
+		struct indexed_window *entry = g_hash_table_lookup(windows, list->data);
+
+		if (entry && (candidates[0] == windows ||
+		              in_set(candidates[0], entry) || in_set(candidates[1], entry)) &&
+		    query_matches(query, entry))
+			result = g_slist_prepend(result, entry->window);
+	}
+
+	return g_slist_reverse(result);
+}
+
+
+/**
+ * Calls the action (a method name or a function) on one window, with the
+ * extra arguments from index first_arg on
+ */
+static int call_action(lua_State *lua, WnckWindow *window, int first_arg)
+{
+	int nargs = lua_gettop(lua) - first_arg + 1;
+
+	push_window_handle(lua, window);
+
+	if (lua_type(lua, 2) == LUA_TSTRING) {
+		lua_getfield(lua, -1, lua_tostring(lua, 2));
+		if (lua_isnil(lua, -1)) {
+			lua_pop(lua, 2);
+			lua_pushfstring(lua, "find_windows: no such method \"%s\"", lua_tostring(lua, 2));
+			return LUA_ERRRUN;
+		}
+	} else {
+		lua_pushvalue(lua, 2);
+	}
+
+	lua_insert(lua, -2); // the window is the first argument
+	for (int i = 0; i < nargs; i++)
+		lua_pushvalue(lua, first_arg + i);
+
+	script_begin_no_wait();
+	int status = lua_pcall(lua, nargs + 1, 0, 0);
+	script_end_no_wait();
+
+	return status;
+}
+
+
+/**
+ * find_windows({ class = ..., role = ..., pid = ..., workspace = ...,
+ *                monitor = ... } [, action, ...])
+ * Without an action, returns a list of window objects. With one (the name
+ * of a window method, or a function taking a window object), calls it for
+ * every matching window, passing any remaining parameters, with all of
+ * the resulting changes sent in one batch; returns the number of windows.
+ */
+int c_find_windows(lua_State *lua)
+{
+	int top = lua_gettop(lua);
+
+	if (top < 1 || lua_type(lua, 1) != LUA_TTABLE) {
+		luaL_error(lua, "find_windows: %s", table_expected_as_indata_error);
+		return 0;
+	}
+
+	if (top >= 2 && lua_type(lua, 2) != LUA_TSTRING && lua_type(lua, 2) != LUA_TFUNCTION) {
+		luaL_error(lua, "find_windows: %s", "method name or function expected");
+		return 0;
+	}
+
+	struct window_query query;
+	read_query(lua, &query);
+
+	GSList *found = find_windows(&query);
+
+	if (top < 2) {
+		int i = 0;
+
+		lua_createtable(lua, g_slist_length(found), 0);
+		for (GSList *item = found; item; item = item->next) {
+			push_window_handle(lua, item->data);
+			lua_rawseti(lua, -2, ++i);
+		}
+		g_slist_free(found);
+		return 1;
+	}
+
+	// collect the changes unless something else already is
+	gboolean own_batch = !collecting_window_changes() && begin_layout_changes();
+	int count = 0, status = 0;
+
+	for (GSList *item = found; item && status == 0; item = item->next) {
+		status = call_action(lua, item->data, 3);
+		count++;
+	}
+	g_slist_free(found);
+
+	if (own_batch) {
+		commit_layout_changes();
+		XFlush(gdk_x11_get_default_xdisplay());
+	}
+
+	if (status != 0)
+		return lua_error(lua);
+
+	lua_pushinteger(lua, count);
+	return 1;
+}
@@ -0,0 +1,312 @@
+/**
+ *	This file is part of devilspie2
+ *	Copyright (C) 2026 devilspie2 developers
+ *
+ *	devilspie2 is free software: you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as published
+ *	by the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	devilspie2 is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with devilspie2.
+ *	If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+
+#define WNCK_I_KNOW_THIS_IS_UNSTABLE
+#include <libwnck/libwnck.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include "script.h"
+#include "script_functions.h"
+
+#include "window_object.h"
+
+#define WINDOW_METATABLE "devilspie2.window"
+#define WINDOW_HANDLES   "devilspie2.windows"
+
+
+/**
+ * A window handle is just its XID, so that a handle for a window which
+ * has since closed is harmless: its methods return nil.
+ */
+struct window_handle {
+	gulong xid;
+};
+
+
+/**
+ * The functions which work on the current window, available as methods
+ * of window handles, e.g. w:get_window_name() or w:xywh(0, 0, 800, 600)
+ */
+static const struct {
+	const char *name;
+	lua_CFunction func;
+} window_methods[] = {
+	{ "get_window_name", c_get_window_name },
+	{ "get_window_has_name", c_get_window_has_name },
+	{ "get_application_name", c_get_application_name },
+	{ "get_window_geometry", c_get_window_geometry },
+	{ "get_window_client_geometry", c_get_window_client_geometry },
+	{ "get_window_frame_extents", c_get_window_frame_extents },
+	{ "get_window_strut", c_get_window_strut },
+	{ "get_window_is_maximized", c_get_window_is_maximized },
+	{ "get_window_is_maximized_vertically", c_get_window_is_maximized_vertically },
+	{ "get_window_is_maximized_horizontally", c_get_window_is_maximized_horizontally },
+	{ "get_window_is_pinned", c_get_window_is_pinned },
+	{ "get_window_is_decorated", c_get_window_is_decorated },
+	{ "get_window_fullscreen", c_get_window_fullscreen },
+	{ "get_window_type", c_get_window_type },
+	{ "get_window_property", c_get_window_property },
+	{ "window_property_is_utf8", c_window_property_is_utf8 },
+	{ "get_window_property_full", c_get_window_property_full },
+	{ "get_window_properties", c_get_window_properties },
+	{ "get_window_role", c_get_window_role },
+	{ "get_window_xid", c_get_window_xid },
+	{ "get_window_class", c_get_window_class },
+	{ "get_class_instance_name", c_get_class_instance_name },
+	{ "get_class_group_name", c_get_class_group_name },
+	{ "get_monitor_index", c_get_monitor_index },
+	{ "get_process_name", c_get_process_name },
+	{ "get_process_owner", c_get_process_owner },
+	{ "get_window_info", c_get_window_info },
+
+	{ "set_window_position", c_set_window_position },
+	{ "set_window_position2", c_set_window_position2 },
+	{ "set_window_size", c_set_window_size },
+	{ "set_window_geometry", c_set_window_geometry },
+	{ "set_window_geometry2", c_set_window_geometry2 },
+	{ "set_window_strut", c_set_window_strut },
+	{ "xy", c_xy },
+	{ "xywh", c_xywh },
+	{ "center", c_center },
+	{ "centre", c_center },
+	{ "set_viewport", c_set_viewport },
+	{ "shade", c_shade },
+	{ "unshade", c_unshade },
+	{ "maximize", c_maximize },
+	{ "maximise", c_maximize },
+	{ "maximize_horizontally", c_maximize_horizontally },
+	{ "maximise_horizontally", c_maximize_horizontally },
+	{ "maximize_vertically", c_maximize_vertically },
+	{ "maximise_vertically", c_maximize_vertically },
+	{ "unmaximize", c_unmaximize },
+	{ "unmaximise", c_unmaximize },
+	{ "minimize", c_minimize },
+	{ "minimise", c_minimize },
+	{ "unminimize", c_unminimize },
+	{ "unminimise", c_unminimize },
+	{ "decorate_window", c_decorate_window },
+	{ "undecorate_window", c_undecorate_window },
+	{ "set_window_workspace", c_set_window_workspace },
+	{ "pin_window", c_pin_window },
+	{ "unpin_window", c_unpin_window },
+	{ "stick_window", c_stick_window },
+	{ "unstick_window", c_unstick_window },
+	{ "close_window", c_close_window },
+	{ "set_skip_tasklist", c_set_skip_tasklist },
+	{ "set_skip_pager", c_set_skip_pager },
+	{ "set_window_above", c_set_window_above },
+	{ "set_window_below", c_set_window_below },
+	{ "set_window_fullscreen", c_set_window_fullscreen },
+	{ "make_always_on_top", c_make_always_on_top },
+	{ "set_on_top", c_set_on_top },
+	{ "set_on_bottom", c_set_on_bottom },
+	{ "set_window_property", c_set_window_property },
+	{ "delete_window_property", c_delete_window_property },
+	{ "set_window_opacity", c_set_window_opacity },
+	{ "set_opacity", c_set_window_opacity },
+	{ "set_window_type", c_set_window_type },
+	{ "focus", c_focus },
+	{ "focus_window", c_focus },
+	{ "on_geometry_changed", c_on_geometry_changed },
+};
+
+
+/**
+ * Finds the window for a handle, or NULL if it's gone
+ */
+static WnckWindow *handle_window(lua_State *lua, int index)
+{
+	struct window_handle *handle = luaL_checkudata(lua, index, WINDOW_METATABLE);
+
+	return wnck_handle_get_window(my_wnck_handle, handle->xid);
+}
+
+
+/**
+ * Calls the function in upvalue 1 with the handle's window as the current
+ * window. The current window is restored even if the function fails.
+ */
+static int call_window_method(lua_State *lua)
+{
+	WnckWindow *window = handle_window(lua, 1);
+
+	if (!window) {
+		lua_pushnil(lua);
+		return 1;
+	}
+
+	WnckWindow *previous = get_current_window();
+	int nargs = lua_gettop(lua) - 1;
+	int status;
+
+	lua_pushvalue(lua, lua_upvalueindex(1));
+	lua_replace(lua, 1);
+
+	set_current_window(window);
+	script_begin_no_wait();
+	status = lua_pcall(lua, nargs, LUA_MULTRET, 0);
+	script_end_no_wait();
+	set_current_window(previous);
+
+	if (status != 0)
+		return lua_error(lua);
+
+	return lua_gettop(lua);
+}
+
+
+/**
+ *
+ */
+static int window_tostring(lua_State *lua)
+{
+	struct window_handle *handle = luaL_checkudata(lua, 1, WINDOW_METATABLE);
+	char text[32];
+
+	g_snprintf(text, sizeof(text), "window 0x%lx", handle->xid);
+	lua_pushstring(lua, text);
+	return 1;
+}
+
+
+/**
+ *
+ */
+static int window_eq(lua_State *lua)
+{
+	struct window_handle *a = luaL_checkudata(lua, 1, WINDOW_METATABLE);
+	struct window_handle *b = luaL_checkudata(lua, 2, WINDOW_METATABLE);
+
+	lua_pushboolean(lua, a->xid == b->xid);
+	return 1;
+}
+
+
+/**
+ * w:is_valid() - whether the window still exists
+ */
+static int window_is_valid(lua_State *lua)
+{
+	lua_pushboolean(lua, handle_window(lua, 1) != NULL);
+	return 1;
+}
+
+
+/**
+ * Pushes the handle for a window (or nil). Handles are kept in a weak
+ * table, so the same window gives the same handle while it's in use.
+ */
+void push_window_handle(lua_State *lua, WnckWindow *window)
+{
+	if (!window) {
+		lua_pushnil(lua);
+		return;
+	}
+
+	gulong xid = wnck_window_get_xid(window);
+
+	lua_getfield(lua, LUA_REGISTRYINDEX, WINDOW_HANDLES);
+	lua_pushnumber(lua, xid);
+	lua_rawget(lua, -2);
+
+	if (lua_isnil(lua, -1)) {
+		lua_pop(lua, 1);
+
+		struct window_handle *handle = lua_newuserdata(lua, sizeof(struct window_handle));
+		handle->xid = xid;
+		luaL_getmetatable(lua, WINDOW_METATABLE);
+		lua_setmetatable(lua, -2);
+
+		lua_pushnumber(lua, xid);
+		lua_pushvalue(lua, -2);
+		lua_rawset(lua, -4);
+	}
+
+	lua_remove(lua, -2);
+}
+
+
+/**
+ * current_window()
+ */
+static int c_current_window(lua_State *lua)
+{
+	push_window_handle(lua, get_current_window());
+	return 1;
+}
+
+
+/**
+ * windows()
+ * Returns handles for all windows, bottom-most first
+ */
+static int c_windows(lua_State *lua)
+{
+	WnckScreen *screen = wnck_handle_get_default_screen(my_wnck_handle);
+	GList *list = screen ? wnck_screen_get_windows_stacked(screen) : NULL;
+	int i = 0;
+
+	lua_createtable(lua, g_list_length(list), 0);
+	for (; list; list = list->next) {
+		push_window_handle(lua, list->data);
+		lua_rawseti(lua, -2, ++i);
+	}
+
+	return 1;
+}
+
+
+/**
+ * Sets up the window handle metatable and registers current_window()
+ * and windows()
+ */
+void register_window_object(lua_State *lua)
+{
+	luaL_newmetatable(lua, WINDOW_METATABLE);
+
+	lua_newtable(lua);
+	for (gsize i = 0; i < G_N_ELEMENTS(window_methods); i++) {
+		lua_pushcfunction(lua, window_methods[i].func);
+		lua_pushcclosure(lua, call_window_method, 1);
+		lua_setfield(lua, -2, window_methods[i].name);
+	}
+	lua_pushcfunction(lua, window_is_valid);
+	lua_setfield(lua, -2, "is_valid");
+	lua_setfield(lua, -2, "__index");
+
+	lua_pushcfunction(lua, window_tostring);
+	lua_setfield(lua, -2, "__tostring");
+	lua_pushcfunction(lua, window_eq);
+	lua_setfield(lua, -2, "__eq");
+	lua_pop(lua, 1);
+
+	lua_newtable(lua);
+	lua_newtable(lua);
+	lua_pushstring(lua, "v");
+	lua_setfield(lua, -2, "__mode");
+	lua_setmetatable(lua, -2);
+	lua_setfield(lua, LUA_REGISTRYINDEX, WINDOW_HANDLES);
+
+	lua_register(lua, "current_window", c_current_window);
+	lua_register(lua, "windows", c_windows);
+}
@@ -23,18 +23,31 @@
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 #include <X11/Xlib.h>
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#endif
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
 // FIXME: retrieve screen position via wnck
 #include <X11/extensions/Xinerama.h>
+#ifdef HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+#ifdef HAVE_XRES
+#include <X11/extensions/XRes.h>
+#endif
 
 #define WNCK_I_KNOW_THIS_IS_UNSTABLE
 #include <libwnck/libwnck.h>
 
 #include <locale.h>
 
+#include <lua.h>
+
 #include "intl.h"
+#include "script.h"
 #include "xutils.h"
 
 
@@ -46,6 +59,94 @@
 static GHashTable *atom_hash = NULL;
 static GHashTable *reverse_atom_hash = NULL;
 
+/**
+ * The atoms which devilspie2 itself uses, interned together in one round
+ * trip when the first atom is asked for
+ */
+static const char *const known_atoms[] = {
+	"UTF8_STRING",
+	"WM_CLASS",
+	"WM_CLIENT_LEADER",
+	"WM_CLIENT_MACHINE",
+	"WM_NAME",
+	"WM_PROTOCOLS",
+	"WM_STATE",
+	"WM_TRANSIENT_FOR",
+	"WM_WINDOW_ROLE",
+	"_MOTIF_WM_HINTS",
+	"_NET_ACTIVE_WINDOW",
+	"_NET_CLIENT_LIST",
+	"_NET_CURRENT_DESKTOP",
+	"_NET_DESKTOP_GEOMETRY",
+	"_NET_DESKTOP_NAMES",
+	"_NET_DESKTOP_VIEWPORT",
+	"_NET_FRAME_EXTENTS",
+	"_NET_NUMBER_OF_DESKTOPS",
+	"_NET_SUPPORTED",
+	"_NET_WM_DESKTOP",
+	"_NET_WM_NAME",
+	"_NET_WM_PID",
+	"_NET_WM_STATE",
+	"_NET_WM_STATE_ABOVE",
+	"_NET_WM_STATE_BELOW",
+	"_NET_WM_STATE_DEMANDS_ATTENTION",
+	"_NET_WM_STATE_FULLSCREEN",
+	"_NET_WM_STATE_HIDDEN",
+	"_NET_WM_STATE_MAXIMIZED_HORZ",
+	"_NET_WM_STATE_MAXIMIZED_VERT",
+	"_NET_WM_STATE_SHADED",
+	"_NET_WM_STATE_SKIP_PAGER",
+	"_NET_WM_STATE_SKIP_TASKBAR",
+	"_NET_WM_STATE_STICKY",
+	"_NET_WM_STRUT",
+	"_NET_WM_STRUT_PARTIAL",
+	"_NET_WM_VISIBLE_NAME",
+	"_NET_WM_WINDOW_OPACITY",
+	"_NET_WM_WINDOW_TYPE",
+	"_NET_WM_WINDOW_TYPE_DESKTOP",
+	"_NET_WM_WINDOW_TYPE_DIALOG",
+	"_NET_WM_WINDOW_TYPE_DOCK",
+	"_NET_WM_WINDOW_TYPE_MENU",
+	"_NET_WM_WINDOW_TYPE_NORMAL",
+	"_NET_WM_WINDOW_TYPE_SPLASH",
+	"_NET_WM_WINDOW_TYPE_TOOLBAR",
+	"_NET_WM_WINDOW_TYPE_UTILITY",
+	"_NET_WORKAREA",
+	"_OB_WM_STATE_UNDECORATED",
+};
+
+
+/**
+ *
+ */
+static void add_atom(const char *atom_name, Atom atom)
+{
+	char *name_copy = g_strdup (atom_name);
+
+	g_hash_table_insert (atom_hash, name_copy, GUINT_TO_POINTER (atom));
+	g_hash_table_insert (reverse_atom_hash, GUINT_TO_POINTER (atom), name_copy);
+}
+
+
+/**
+ *
+ */
+static void init_atoms(void)
+{
+	Atom atoms[G_N_ELEMENTS (known_atoms)];
+	guint i;
+
+	atom_hash = g_hash_table_new (g_str_hash, g_str_equal);
+	reverse_atom_hash = g_hash_table_new (NULL, NULL);
+
+	if (XInternAtoms (gdk_x11_get_default_xdisplay(), (char **)known_atoms,
+	                  G_N_ELEMENTS (known_atoms), False, atoms)) {
+		for (i = 0; i < G_N_ELEMENTS (known_atoms); i++)
+			if (atoms[i] != None)
+				add_atom (known_atoms[i], atoms[i]);
+	}
+}
+
 
 /**
  *
@@ -56,29 +157,79 @@ Atom my_wnck_atom_get(const char *atom_name)
 
 	g_return_val_if_fail (atom_name != NULL, None);
 
-	if (!atom_hash) {
-		atom_hash = g_hash_table_new (g_str_hash, g_str_equal);
-		reverse_atom_hash = g_hash_table_new (NULL, NULL);
-	}
+	if (!atom_hash)
+		init_atoms ();
 
 	retval = GPOINTER_TO_UINT (g_hash_table_lookup (atom_hash, atom_name));
 	if (!retval) {
 		retval = XInternAtom (gdk_x11_get_default_xdisplay(), atom_name, FALSE);
 
-		if (retval != None) {
-			char *name_copy;
+		if (retval != None)
+			add_atom (atom_name, retval);
+	}
+	return retval;
+}
+
+
+/**
+ * Looks up the names of count atoms, fetching any which aren't already
+ * known in one round trip. The names are owned by the atom cache; any
+ * which can't be found are set to NULL.
+ */
+void my_wnck_atom_names(const Atom *atoms, int count, const char **names)
+{
+	Atom *missing = g_new (Atom, count);
+	char **missing_names;
+	int i, n_missing = 0;
+
+	if (!atom_hash)
+		init_atoms ();
+
+	for (i = 0; i < count; i++) {
+		names[i] = g_hash_table_lookup (reverse_atom_hash, GUINT_TO_POINTER (atoms[i]));
+		if (!names[i] && atoms[i] != None)
+			missing[n_missing++] = atoms[i];
+	}
+
+	if (n_missing) {
+		missing_names = g_new0 (char *, n_missing);
 
-			name_copy = g_strdup (atom_name);
+		devilspie2_error_trap_push ();
+		if (!XGetAtomNames (gdk_x11_get_default_xdisplay (), missing, n_missing, missing_names)) {
+			// one bad atom fails the lot, so ask for the others one at a time
+			for (i = 0; i < n_missing; i++)
+				if (!missing_names[i])
+					missing_names[i] = XGetAtomName (gdk_x11_get_default_xdisplay (), missing[i]);
+		}
+		devilspie2_error_trap_pop ();
 
-			g_hash_table_insert (atom_hash,
-			                     name_copy,
-			                     GUINT_TO_POINTER (retval));
-			g_hash_table_insert (reverse_atom_hash,
-			                     GUINT_TO_POINTER (retval),
-			                     name_copy);
+		for (i = 0; i < n_missing; i++) {
+			if (missing_names[i]) {
+				if (!g_hash_table_lookup (reverse_atom_hash, GUINT_TO_POINTER (missing[i])))
+					add_atom (missing_names[i], missing[i]);
+				XFree (missing_names[i]);
+			}
 		}
+		g_free (missing_names);
+
+		for (i = 0; i < count; i++)
+			if (!names[i])
+				names[i] = g_hash_table_lookup (reverse_atom_hash, GUINT_TO_POINTER (atoms[i]));
 	}
-	return retval;
+
+	g_free (missing);
+}
+
+
+/**
+ *
+ */
+const char *my_wnck_atom_name(Atom atom)
+{
+	const char *name;
+
+	my_wnck_atom_names (&atom, 1, &name);
+	return name;
 }
 
 
@@ -90,7 +241,7 @@ void devilspie2_change_state(Screen *screen, Window xwindow,
                              Atom     state1,
                              Atom     state2)
 {
-	XEvent xev;
+	XEvent xev = {};
 
 #define _NET_WM_STATE_REMOVE        0    /* remove/unset property */
 #define _NET_WM_STATE_ADD           1    /* add/set property */
@@ -106,6 +257,7 @@ void devilspie2_change_state(Screen *screen, Window xwindow,
 	xev.xclient.data.l[0] = add ? _NET_WM_STATE_ADD : _NET_WM_STATE_REMOVE;
 	xev.xclient.data.l[1] = state1;
 	xev.xclient.data.l[2] = state2;
+	xev.xclient.data.l[3] = 2; /* source: pager, as libwnck sends */
 
 	XSendEvent (gdk_x11_get_default_xdisplay(),
 	            RootWindowOfScreen (screen),
@@ -115,12 +267,104 @@ void devilspie2_change_state(Screen *screen, Window xwindow,
 }
 
 
+/**
+ *
+ */
+Screen *devilspie2_window_get_xscreen(Window xid)
+{
+	XWindowAttributes attrs;
+
+	XGetWindowAttributes(gdk_x11_get_default_xdisplay(), xid, &attrs);
+
+	return attrs.screen;
+}
+
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+/**
+ * Asynchronous error reporting. Instead of waiting for the server at the
+ * end of each trapped request, the range of request serial numbers is
+ * noted along with the script and line which made the requests; errors are
+ * then reported by our error handler whenever they turn up. (GTK 2 has no
+ * way to leave an error trap without waiting, so this is for GTK 3 only.)
+ */
+struct pending_requests {
+	gulong first, last;
+	gchar *location;
+};
+
+static GQueue pending_requests = G_QUEUE_INIT;
+static int trap_depth = 0;
+static gulong trap_start;
+static XErrorHandler previous_error_handler = NULL;
+
+
+/**
+ *
+ */
+static void free_pending_requests(struct pending_requests *pending)
+{
+	g_free(pending->location);
+	g_free(pending);
+}
+
+
+/**
+ * Forgets request ranges which the server has finished with
+ */
+static void prune_pending_requests(Display *dpy)
+{
+	gulong done = LastKnownRequestProcessed(dpy);
+	struct pending_requests *pending;
+
+	while ((pending = g_queue_peek_head(&pending_requests)) && (glong)(done - pending->last) >= 0)
+		free_pending_requests(g_queue_pop_head(&pending_requests));
+}
+
+
+/**
+ * Only called outside GDK's error traps, which have their own handler; so
+ * errors for a range whose trap is still open never get here
+ */
+static int async_error_handler(Display *dpy, XErrorEvent *error)
+{
+	for (GList *link = pending_requests.head; link; link = link->next) {
+		struct pending_requests *pending = link->data;
+
+		if ((glong)(error->serial - pending->first) >= 0 &&
+		    (glong)(pending->last - error->serial) >= 0) {
+			char text[256];
+
+			XGetErrorText(dpy, error->error_code, text, sizeof(text));
+			g_printerr(_("%s: X error: %s (request %d.%d)\n"),
+			           pending->location ? pending->location : "devilspie2",
+			           text, error->request_code, error->minor_code);
+			return 0;
+		}
+	}
+
+	return previous_error_handler ? previous_error_handler(dpy, error) : 0;
+}
+#endif
+
+
 /**
  *
  */
 void devilspie2_error_trap_push()
 {
 #if GTK_CHECK_VERSION(3, 0, 0)
+	// async_x_errors is only looked at when no trap is open
+	if ((trap_depth || async_x_errors) && trap_depth++ == 0) {
+		Display *dpy = gdk_x11_get_default_xdisplay();
+
+		if (!previous_error_handler)
+			previous_error_handler = XSetErrorHandler(async_error_handler);
+
+		prune_pending_requests(dpy);
+		trap_start = NextRequest(dpy);
+	}
+
 	gdk_x11_display_error_trap_push(gdk_display_get_default());
 #else
 	gdk_error_trap_push();
@@ -129,11 +373,39 @@ void devilspie2_error_trap_push()
 
 
 /**
- *
+ * Returns the error, if any, caused by the trapped requests. In
+ * asynchronous mode, that's only known if one of them had to wait for a
+ * reply; otherwise, any error is reported later.
  */
 int devilspie2_error_trap_pop()
 {
 #if GTK_CHECK_VERSION(3, 0, 0)
+	if (trap_depth > 0) {
+		Display *dpy = gdk_x11_get_default_xdisplay();
+		gulong next = NextRequest(dpy);
+
+		// the server has already answered for some of the requests, so
+		// whatever they asked for may depend on them having worked: let
+		// GDK say (waiting only for any requests sent since)
+		if ((glong)(LastKnownRequestProcessed(dpy) - trap_start) >= 0) {
+			--trap_depth;
+			return gdk_x11_display_error_trap_pop(gdk_display_get_default());
+		}
+
+		if (--trap_depth == 0 && next != trap_start) {
+			struct pending_requests *pending = g_new(struct pending_requests, 1);
+			pending->first = trap_start;
+			pending->last = next - 1;
+			pending->location = get_script_location();
+			g_queue_push_tail(&pending_requests, pending);
+		}
+
+		// GDK goes on ignoring errors in this range if they turn up while
+		// its own handler is active (during someone else's trap)
+		gdk_x11_display_error_trap_pop_ignored(gdk_display_get_default());
+		return Success;
+	}
+
 	return gdk_x11_display_error_trap_pop(gdk_display_get_default());
 #else
 	XSync(gdk_x11_get_default_xdisplay(),False);
@@ -142,6 +414,260 @@ int devilspie2_error_trap_pop()
 }
 
 
+/**
+ * Property values of the windows which we're watching (see
+ * watch_window_properties), so that repeated questions about the same
+ * window needn't go to the server. Entries are dropped when PropertyNotify
+ * says that the property has changed, and when the window is closed.
+ */
+struct cached_property {
+	gchar *value;
+	gboolean utf8;
+};
+
+struct window_properties {
+	GHashTable *strings; /* Atom → struct cached_property */
+	int decorated;       /* -1 if not known */
+};
+
+static GHashTable *property_cache = NULL;
+
+
+/**
+ *
+ */
+static void free_cached_property(gpointer data)
+{
+	struct cached_property *cached = data;
+
+	g_free(cached->value);
+	g_free(cached);
+}
+
+
+/**
+ *
+ */
+static void free_window_properties(gpointer data)
+{
+	struct window_properties *props = data;
+
+	g_hash_table_destroy(props->strings);
+	g_free(props);
+}
+
+
+/**
+ *
+ */
+static struct window_properties *get_window_properties(Window xid)
+{
+	return property_cache ? g_hash_table_lookup(property_cache, GSIZE_TO_POINTER(xid)) : NULL;
+}
+
+
+/**
+ * Forgets the cached value of a window property (and anything derived
+ * from it)
+ */
+void invalidate_window_property(Window xid, Atom atom)
+{
+	struct window_properties *props = get_window_properties(xid);
+
+	if (!props)
+		return;
+
+	g_hash_table_remove(props->strings, GUINT_TO_POINTER(atom));
+	if (atom == my_wnck_atom_get("_MOTIF_WM_HINTS"))
+		props->decorated = -1;
+}
+
+
+/**
+ * Stops caching a window's properties (when it's closed)
+ */
+void forget_window_properties(Window xid)
+{
+	if (property_cache)
+		g_hash_table_remove(property_cache, GSIZE_TO_POINTER(xid));
+}
+
+
+#ifdef HAVE_XRES
+/**
+ * PIDs from the X-Resource extension, for clients which don't set
+ * _NET_WM_PID. They're kept per client, so that its other windows needn't
+ * be asked about, until the last of its windows which we know of has
+ * closed (the server reuses client IDs).
+ */
+struct client_pid {
+	pid_t pid;            /* 0 if the server doesn't know (remote clients) */
+	GHashTable *windows;
+};
+
+static GHashTable *client_pids = NULL; /* client resource base → struct client_pid */
+static XID client_resource_mask = 0;
+static int xres_state = 0; /* 0 = not checked yet, 1 = usable, -1 = not */
+
+
+/**
+ *
+ */
+static void free_client_pid(gpointer data)
+{
+	struct client_pid *client = data;
+
+	g_hash_table_destroy(client->windows);
+	g_free(client);
+}
+
+
+/**
+ * Checks for X-Resource 1.2 (for client IDs) and finds out which bits of
+ * an XID identify the client
+ */
+static gboolean xres_available(Display *dpy)
+{
+	if (xres_state == 0) {
+		int event_base, error_base, major, minor, count;
+		XResClient *clients;
+
+		xres_state = -1;
+		if (XResQueryExtension(dpy, &event_base, &error_base) &&
+		    XResQueryVersion(dpy, &major, &minor) &&
+		    (major > 1 || (major == 1 && minor >= 2)) &&
+		    XResQueryClients(dpy, &count, &clients) == Success) {
+			if (count > 0) {
+				client_resource_mask = clients[0].resource_mask;
+				client_pids = g_hash_table_new_full(NULL, NULL, NULL, free_client_pid);
+				xres_state = 1;
+			}
+			XFree(clients);
+		}
+	}
+
+	return xres_state > 0;
+}
+
+
+/**
+ *
+ */
+static struct client_pid *lookup_client_pid(XID xid)
+{
+	return g_hash_table_lookup(client_pids, GSIZE_TO_POINTER(xid & ~client_resource_mask));
+}
+#endif
+
+
+/**
+ * Finds out the PIDs of the clients owning these windows, asking the X
+ * server about all of the clients not already known in one request
+ */
+void prefetch_client_pids(const Window *xids, int count)
+{
+#ifdef HAVE_XRES
+	Display *dpy = gdk_x11_get_default_xdisplay();
+	XResClientIdSpec *specs;
+	int wanted = 0;
+
+	if (count == 0 || !xres_available(dpy))
+		return;
+
+	specs = g_new(XResClientIdSpec, count);
+
+	for (int i = 0; i < count; i++) {
+		struct client_pid *client = lookup_client_pid(xids[i]);
+
+		if (client) {
+			g_hash_table_add(client->windows, GSIZE_TO_POINTER(xids[i]));
+		} else {
+			specs[wanted].client = xids[i];
+			specs[wanted].mask = XRES_CLIENT_ID_PID_MASK;
+			wanted++;
+		}
+	}
+
+	if (wanted) {
+		XResClientIdValue *ids = NULL;
+		long num_ids = 0;
+		Status status;
+
+		devilspie2_error_trap_push();
+		status = XResQueryClientIds(dpy, wanted, specs, &num_ids, &ids);
+		devilspie2_error_trap_pop();
+
+		// what isn't in the reply isn't known; don't ask again
+		for (int i = 0; i < wanted; i++) {
+			struct client_pid *client = lookup_client_pid(specs[i].client);
+
+			if (!client) {
+				client = g_new0(struct client_pid, 1);
+				client->windows = g_hash_table_new(NULL, NULL);
+				g_hash_table_insert(client_pids,
+				                    GSIZE_TO_POINTER(specs[i].client & ~client_resource_mask),
+				                    client);
+			}
+			g_hash_table_add(client->windows, GSIZE_TO_POINTER(specs[i].client));
+		}
+
+		if (status == Success) {
+			for (long i = 0; i < num_ids; i++) {
+				struct client_pid *client = lookup_client_pid(ids[i].spec.client);
+
+				if (client && (ids[i].spec.mask & XRES_CLIENT_ID_PID_MASK))
+					client->pid = XResGetClientPid(&ids[i]);
+			}
+			XResClientIdsDestroy(num_ids, ids);
+		}
+	}
+
+	g_free(specs);
+#endif
+}
+
+
+/**
+ * Forgets a window (when it's closed) for the client PID cache
+ */
+void forget_client_window(Window xid)
+{
+#ifdef HAVE_XRES
+	struct client_pid *client = client_pids ? lookup_client_pid(xid) : NULL;
+
+	if (client) {
+		g_hash_table_remove(client->windows, GSIZE_TO_POINTER(xid));
+		if (g_hash_table_size(client->windows) == 0)
+			g_hash_table_remove(client_pids, GSIZE_TO_POINTER(xid & ~client_resource_mask));
+	}
+#endif
+}
+
+
+/**
+ * Returns the window's PID: from _NET_WM_PID if set, else as the X server
+ * knows it (if it's new enough and the client is local); 0 if not known
+ */
+pid_t get_window_pid(WnckWindow *window)
+{
+	pid_t pid = wnck_window_get_pid(window);
+
+#ifdef HAVE_XRES
+	if (pid == 0) {
+		Window xid = wnck_window_get_xid(window);
+		struct client_pid *client;
+
+		prefetch_client_pids(&xid, 1);
+		client = client_pids ? lookup_client_pid(xid) : NULL;
+		if (client)
+			pid = client->pid;
+	}
+#endif
+
+	return pid;
+}
+
+
 /**
  *
  */
@@ -161,6 +687,7 @@ static void set_decorations(Window xid /*WnckWindow *window*/, gboolean decorate
 	hints.decorations = decorate ? 1 : 0;
 
 	/* Set Motif hints, most window managers handle these */
+	invalidate_window_property(xid, my_wnck_atom_get ("_MOTIF_WM_HINTS"));
 	XChangeProperty(gdk_x11_get_default_xdisplay(), xid /*wnck_window_get_xid (window)*/,
 	                my_wnck_atom_get ("_MOTIF_WM_HINTS"),
 	                my_wnck_atom_get ("_MOTIF_WM_HINTS"), 32, PropModeReplace,
@@ -224,12 +751,18 @@ gboolean undecorate_window(Window xid)
  */
 gboolean get_decorated(Window xid /*WnckWindow *window*/)
 {
+	struct window_properties *props = get_window_properties(xid);
+
+	if (props && props->decorated >= 0)
+		return props->decorated;
+
 	Display *disp = gdk_x11_get_default_xdisplay();
 	Atom type_ret;
-	Atom hints_atom = XInternAtom(disp, "_MOTIF_WM_HINTS", False);
+	Atom hints_atom = my_wnck_atom_get("_MOTIF_WM_HINTS");
 	int format_ret;
 	int err, result = 0;
-	unsigned long nitems_ret, bytes_after_ret, *prop_ret;
+	unsigned long nitems_ret, bytes_after_ret, *prop_ret = NULL;
+	gboolean decorated;
 
 	devilspie2_error_trap_push();
 	XGetWindowProperty(disp, xid, hints_atom, 0,
@@ -241,92 +774,65 @@ gboolean get_decorated(Window xid /*WnckWindow *window*/)
 	if (err != Success || result != Success)
 		return FALSE;
 
-	return type_ret != hints_atom || nitems_ret < 3 || prop_ret[2] != 0;
+	decorated = type_ret != hints_atom || nitems_ret < 3 || prop_ret[2] != 0;
+	if (prop_ret)
+		XFree(prop_ret);
+
+	if (props)
+		props->decorated = decorated;
+
+	return decorated;
 }
 
 
 /**
- *
+ * How much (in 32-bit units) to read before we know what the property is
  */
-Screen *devilspie2_window_get_xscreen(Window xid)
-{
-	XWindowAttributes attrs;
+#define STRING_PROPERTY_FIRST_READ 1024
 
-	XGetWindowAttributes(gdk_x11_get_default_xdisplay(), xid, &attrs);
 
-	return attrs.screen;
+/**
+ * Whether the rest of a property is worth fetching once the first
+ * STRING_PROPERTY_FIRST_READ units have been read
+ */
+static gboolean read_whole_property(Atom type)
+{
+	// Only strings and atom lists are returned whole; there's no point in
+	// fetching the rest of anything else (such as _NET_WM_ICON).
+	return type == XA_STRING || type == XA_ATOM || type == my_wnck_atom_get("UTF8_STRING");
 }
 
 
 /**
- *
+ * Converts a property value, as returned by XGetWindowProperty, to the
+ * string which get_window_property() returns
  */
-char* my_wnck_get_string_property(Window xwindow, Atom atom, gboolean *utf8)
+static char *property_to_string(Atom type, int format, gulong nitems,
+                                const unsigned char *property, gboolean *utf8)
 {
-	Atom type;
-	int format;
-	gulong nitems;
-	gulong bytes_after;
-	unsigned char *property;
-	int err, result;
-	char *retval;
-	Atom XA_UTF8_STRING;
+	char *retval = NULL;
+	Atom XA_UTF8_STRING = my_wnck_atom_get("UTF8_STRING");
 	gboolean is_utf8 = True;
 
-	if (utf8)
-		*utf8 = False;
+	if (type == XA_STRING) {
+		is_utf8 = False;
+		retval = g_strndup ((char*)property, nitems);
+	} else if (type == XA_UTF8_STRING) {
+		retval = g_strndup ((char*)property, nitems);
+	} else if (type == XA_ATOM && nitems > 0 && format == 32) {
+		const char **prop_names = g_new0 (const char *, nitems + 1);
 
-	devilspie2_error_trap_push();
-	property = NULL;
-	result = XGetWindowProperty (gdk_x11_get_default_xdisplay (),
-	                             xwindow, atom,
-	                             0, G_MAXLONG,
-	                             False, AnyPropertyType, &type,
-	                             &format, &nitems,
-	                             &bytes_after, &property);
-
-	err = devilspie2_error_trap_pop ();
-	if (err != Success || result != Success)
-		return NULL;
-
-	retval = NULL;
-	XA_UTF8_STRING = XInternAtom(gdk_x11_get_default_xdisplay(), "UTF8_STRING", False);
-
-	if (utf8)
-		*utf8 = False;
-
-	if (type == XA_STRING) {
-		is_utf8 = False;
-		retval = g_strdup ((char*)property);
-	} else if (type == XA_UTF8_STRING) {
-		retval = g_strdup ((char*)property);
-	} else if (type == XA_ATOM && nitems > 0 && format == 32) {
-		long *pp;
+		// we can assume (Atom *) since format == 32
+		my_wnck_atom_names ((Atom *)property, nitems, prop_names);
 
-		pp = (long *)property; // we can assume (long *) since format == 32
 		if (nitems == 1) {
-			char* prop_name;
-			prop_name = XGetAtomName (gdk_x11_get_default_xdisplay (), *pp);
-			if (prop_name) {
-				retval = g_strdup (prop_name);
-				XFree (prop_name);
-			}
+			retval = g_strdup (prop_names[0]);
 		} else {
-			gulong i;
-			char** prop_names;
-
-			prop_names = g_new (char *, nitems + 1);
-			prop_names[nitems] = NULL;
-			for (i=0; i < nitems; i++) {
-				prop_names[i] = XGetAtomName (gdk_x11_get_default_xdisplay (),
-				                              *pp++);
-			}
-			retval = g_strjoinv (", ", prop_names);
-			for (i=0; i < nitems; i++) {
-				if (prop_names[i]) XFree (prop_names[i]);
-			}
-			g_free (prop_names);
+			// a name which couldn't be found ends the list, as before
+			retval = g_strjoinv (", ", (char **)prop_names);
 		}
+
+		g_free (prop_names);
 	} else if (type == XA_CARDINAL && nitems == 1) {
 		switch(format) {
 		case 32:
@@ -346,13 +852,371 @@ char* my_wnck_get_string_property(Window xwindow, Atom atom, gboolean *utf8)
 		retval = g_strdup_printf("%lu", (gulong) *(Window *)property);
 	}
 
-	XFree (property);
 	if (utf8)
 		*utf8 = is_utf8;
 	return retval;
 }
 
 
+/**
+ *
+ */
+static char* read_string_property(Window xwindow, Atom atom, gboolean *utf8)
+{
+	Atom type;
+	int format;
+	gulong nitems;
+	gulong bytes_after;
+	unsigned char *property;
+	int err, result;
+	char *retval;
+
+	if (utf8)
+		*utf8 = False;
+
+	devilspie2_error_trap_push();
+	property = NULL;
+	result = XGetWindowProperty (gdk_x11_get_default_xdisplay (),
+	                             xwindow, atom,
+	                             0, STRING_PROPERTY_FIRST_READ,
+	                             False, AnyPropertyType, &type,
+	                             &format, &nitems,
+	                             &bytes_after, &property);
+
+	err = devilspie2_error_trap_pop ();
+	if (err != Success || result != Success)
+		return NULL;
+
+	if (bytes_after && read_whole_property(type)) {
+		// carry on from where the first read stopped
+		Atom rest_type;
+		int rest_format;
+		gulong rest_nitems;
+		unsigned char *rest = NULL;
+
+		devilspie2_error_trap_push();
+		result = XGetWindowProperty (gdk_x11_get_default_xdisplay (),
+		                             xwindow, atom,
+		                             STRING_PROPERTY_FIRST_READ, (bytes_after + 3) / 4,
+		                             False, type, &rest_type,
+		                             &rest_format, &rest_nitems,
+		                             &bytes_after, &rest);
+
+		err = devilspie2_error_trap_pop ();
+		if (err != Success || result != Success) {
+			XFree (property);
+			return NULL;
+		}
+
+		// unless it's been replaced by something else meanwhile
+		if (rest_type == type && rest_format == format && rest_nitems) {
+			// as Xlib stores them: format 32 items are longs, 16 shorts
+			size_t size = format == 32 ? sizeof(long) : format == 16 ? sizeof(short) : 1;
+			unsigned char *whole = g_malloc0 ((nitems + rest_nitems + 1) * size);
+
+			memcpy (whole, property, nitems * size);
+			memcpy (whole + nitems * size, rest, rest_nitems * size);
+			retval = property_to_string(type, format, nitems + rest_nitems, whole, utf8);
+
+			g_free (whole);
+			XFree (rest);
+			XFree (property);
+			return retval;
+		}
+
+		if (rest)
+			XFree (rest);
+	}
+
+	retval = property_to_string(type, format, nitems, property, utf8);
+	XFree (property);
+	return retval;
+}
+
+
+/**
+ * Stores a copy of a property's value
+ */
+static struct cached_property *cache_property(struct window_properties *props, Atom atom,
+                                              const char *value, gboolean utf8)
+{
+	struct cached_property *cached = g_new(struct cached_property, 1);
+
+	cached->value = g_strdup(value);
+	cached->utf8 = utf8;
+	g_hash_table_replace(props->strings, GUINT_TO_POINTER(atom), cached);
+	return cached;
+}
+
+
+/**
+ * As read_string_property, but answered from the cache if possible
+ */
+char* my_wnck_get_string_property(Window xwindow, Atom atom, gboolean *utf8)
+{
+	struct window_properties *props = get_window_properties(xwindow);
+	struct cached_property *cached;
+	gboolean is_utf8;
+
+	if (!props)
+		return read_string_property(xwindow, atom, utf8);
+
+	cached = g_hash_table_lookup(props->strings, GUINT_TO_POINTER(atom));
+	if (!cached) {
+		char *value = read_string_property(xwindow, atom, &is_utf8);
+		cached = cache_property(props, atom, value, is_utf8);
+		g_free(value);
+	}
+
+	if (utf8)
+		*utf8 = cached->utf8;
+	return g_strdup(cached->value);
+}
+
+
+#ifdef HAVE_XCB
+/**
+ * Converts a GetProperty reply, followed by the reply for the rest of the
+ * property if it had to be read in two parts (else NULL), as
+ * read_string_property would; XCB returns format 32 values as 32 bits
+ * each where Xlib uses longs.
+ */
+static char *property_reply_to_string(xcb_get_property_reply_t *reply,
+                                      xcb_get_property_reply_t *rest, gboolean *utf8)
+{
+	const unsigned char *value = xcb_get_property_value(reply);
+	gulong first = reply->value_len;
+	gulong nitems = first;
+	char *retval;
+
+	// unless it's been replaced by something else meanwhile
+	if (rest && (rest->type != reply->type || rest->format != reply->format))
+		rest = NULL;
+	if (rest)
+		nitems += rest->value_len;
+
+	if (reply->format == 32) {
+		gulong *longs = g_new(gulong, nitems + 1);
+
+		for (gulong i = 0; i < first; i++)
+			longs[i] = ((const uint32_t *)value)[i];
+		for (gulong i = first; i < nitems; i++)
+			longs[i] = ((const uint32_t *)xcb_get_property_value(rest))[i - first];
+		retval = property_to_string(reply->type, 32, nitems, (unsigned char *)longs, utf8);
+		g_free(longs);
+	} else if (rest) {
+		int size = reply->format / 8;
+		unsigned char *whole = g_malloc0((nitems + 1) * size);
+
+		memcpy(whole, value, first * size);
+		memcpy(whole + first * size, xcb_get_property_value(rest), (nitems - first) * size);
+		retval = property_to_string(reply->type, reply->format, nitems, whole, utf8);
+		g_free(whole);
+	} else {
+		retval = property_to_string(reply->type, reply->format, nitems, value, utf8);
+	}
+
+	return retval;
+}
+
+
+/**
+ * Waits for a GetProperty reply, discarding any error (such as BadWindow)
+ * rather than letting it reach Xlib's error handler
+ */
+static xcb_get_property_reply_t *get_property_reply(xcb_connection_t *conn,
+                                                    xcb_get_property_cookie_t cookie)
+{
+	xcb_generic_error_t *error = NULL;
+	xcb_get_property_reply_t *reply = xcb_get_property_reply(conn, cookie, &error);
+
+	free(error);
+	return reply;
+}
+
+
+/**
+ * As read_string_property for each atom, but all of the requests are sent
+ * before waiting for any reply; anything which has to be re-read in full
+ * is fetched in a second such batch.
+ */
+static void read_string_properties(Window xwindow, const Atom *atoms, int count,
+                                   char **values, gboolean *utf8)
+{
+	xcb_connection_t *conn = XGetXCBConnection(gdk_x11_get_default_xdisplay());
+	xcb_get_property_cookie_t *cookies = g_new(xcb_get_property_cookie_t, count);
+	xcb_get_property_reply_t **firsts = g_new0(xcb_get_property_reply_t *, count);
+	int i;
+
+	for (i = 0; i < count; i++)
+		cookies[i] = xcb_get_property(conn, 0, xwindow, atoms[i], XCB_GET_PROPERTY_TYPE_ANY,
+		                              0, STRING_PROPERTY_FIRST_READ);
+
+	for (i = 0; i < count; i++) {
+		xcb_get_property_reply_t *reply = get_property_reply(conn, cookies[i]);
+
+		values[i] = NULL;
+		utf8[i] = False;
+		if (!reply)
+			continue;
+
+		if (reply->bytes_after && read_whole_property(reply->type)) {
+			// carry on from where the first read stopped
+			cookies[i] = xcb_get_property(conn, 0, xwindow, atoms[i], reply->type,
+			                              STRING_PROPERTY_FIRST_READ,
+			                              (reply->bytes_after + 3) / 4);
+			firsts[i] = reply;
+		} else {
+			values[i] = property_reply_to_string(reply, NULL, &utf8[i]);
+			free(reply);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (firsts[i]) {
+			xcb_get_property_reply_t *reply = get_property_reply(conn, cookies[i]);
+
+			if (reply) {
+				values[i] = property_reply_to_string(firsts[i], reply, &utf8[i]);
+				free(reply);
+			}
+			free(firsts[i]);
+		}
+	}
+
+	g_free(firsts);
+	g_free(cookies);
+}
+#else
+/**
+ * Without XCB, there's no pipelining; it's one round trip per property.
+ */
+static void read_string_properties(Window xwindow, const Atom *atoms, int count,
+                                   char **values, gboolean *utf8)
+{
+	for (int i = 0; i < count; i++)
+		values[i] = read_string_property(xwindow, atoms[i], &utf8[i]);
+}
+#endif
+
+
+/**
+ * As my_wnck_get_string_property, for several properties at once. Those
+ * which aren't cached are fetched together in one round trip (two if
+ * some of them are long). values[] receives newly-allocated strings, or
+ * NULL for properties which aren't set.
+ */
+void my_wnck_get_string_properties(Window xwindow, const Atom *atoms, int count,
+                                   char **values, gboolean *utf8)
+{
+	struct window_properties *props = get_window_properties(xwindow);
+	Atom *missing = g_new(Atom, count);
+	int *slots = g_new(int, count);
+	int num_missing = 0;
+
+	for (int i = 0; i < count; i++) {
+		struct cached_property *cached =
+			props ? g_hash_table_lookup(props->strings, GUINT_TO_POINTER(atoms[i])) : NULL;
+
+		if (cached) {
+			values[i] = g_strdup(cached->value);
+			utf8[i] = cached->utf8;
+		} else {
+			missing[num_missing] = atoms[i];
+			slots[num_missing++] = i;
+		}
+	}
+
+	if (num_missing) {
+		char **read = g_new(char *, num_missing);
+		gboolean *read_utf8 = g_new(gboolean, num_missing);
+
+		read_string_properties(xwindow, missing, num_missing, read, read_utf8);
+
+		for (int i = 0; i < num_missing; i++) {
+			if (props)
+				cache_property(props, missing[i], read[i], read_utf8[i]);
+			values[slots[i]] = read[i];
+			utf8[slots[i]] = read_utf8[i];
+		}
+
+		g_free(read_utf8);
+		g_free(read);
+	}
+
+	g_free(slots);
+	g_free(missing);
+}
+
+
+/**
+ * Reads part of a window property, without fetching the rest of it: up to
+ * max_bytes, starting at byte offset (rounded down to a multiple of 4, as
+ * the protocol requires). *total is set to the size of the whole property.
+ * Returns Xlib's buffer (free with XFree; longs for format 32), or NULL if
+ * there's nothing to return.
+ */
+unsigned char *my_wnck_get_property_range(Window xwindow, Atom atom,
+                                          gulong offset, gulong max_bytes,
+                                          Atom *type, int *format,
+                                          gulong *nitems, gulong *total)
+{
+	Display *dpy = gdk_x11_get_default_xdisplay();
+	unsigned char *data = NULL;
+	gulong bytes_after;
+	int err, result;
+
+	*type = None;
+	*format = 0;
+	*nitems = 0;
+	*total = 0;
+	offset &= ~3UL;
+
+	if (offset) {
+		// find the size first, since reading past the end is an error
+		devilspie2_error_trap_push();
+		result = XGetWindowProperty(dpy, xwindow, atom, 0, 0, False, AnyPropertyType,
+		                            type, format, nitems, &bytes_after, &data);
+		err = devilspie2_error_trap_pop();
+		if (data)
+			XFree(data);
+		data = NULL;
+
+		if (err != Success || result != Success || *type == None)
+			return NULL;
+
+		*total = bytes_after;
+		*nitems = 0;
+		if (offset >= *total)
+			return NULL;
+	}
+
+	// at least one unit, even for max_bytes == 0, for the type and size
+	gulong length = MIN(max_bytes / 4 + 1, (gulong)G_MAXLONG / 4);
+
+	devilspie2_error_trap_push();
+	result = XGetWindowProperty(dpy, xwindow, atom, offset / 4, length,
+	                            False, AnyPropertyType,
+	                            type, format, nitems, &bytes_after, &data);
+	err = devilspie2_error_trap_pop();
+
+	if (err != Success || result != Success || *type == None) {
+		if (data)
+			XFree(data);
+		*nitems = 0;
+		return NULL;
+	}
+
+	*total = offset + *nitems * (*format / 8) + bytes_after;
+
+	// the reply is in whole 32-bit units; trim to what was asked for
+	if (*format && *nitems > max_bytes / (*format / 8))
+		*nitems = max_bytes / (*format / 8);
+
+	return data;
+}
+
+
 /**
  *
  */
@@ -360,7 +1224,9 @@ void my_wnck_set_string_property(Window xwindow, Atom atom, const gchar *const s
 {
 	const unsigned char *const str = (const unsigned char *)string;
 	Display *display = gdk_x11_get_default_xdisplay();
-	Atom type = utf8 ? XInternAtom(display, "UTF8_STRING", False) : XA_STRING;
+	Atom type = utf8 ? my_wnck_atom_get("UTF8_STRING") : XA_STRING;
+
+	invalidate_window_property(xwindow, atom);
 
 	devilspie2_error_trap_push();
 	XChangeProperty (display, xwindow, atom, type, 8, PropModeReplace, str, strlen(string));
@@ -373,6 +1239,8 @@ void my_wnck_set_string_property(Window xwindow, Atom atom, const gchar *const s
  */
 void my_wnck_set_cardinal_property(Window xwindow, Atom atom, int32_t value)
 {
+	invalidate_window_property(xwindow, atom);
+
 	devilspie2_error_trap_push();
 	XChangeProperty (gdk_x11_get_default_xdisplay (),
 	                 xwindow, atom, XA_CARDINAL, 32,
@@ -386,6 +1254,8 @@ void my_wnck_set_cardinal_property(Window xwindow, Atom atom, int32_t value)
  */
 void my_wnck_delete_property(Window xwindow, Atom atom)
 {
+	invalidate_window_property(xwindow, atom);
+
 	devilspie2_error_trap_push();
 	XDeleteProperty (gdk_x11_get_default_xdisplay (), xwindow, atom);
 	devilspie2_error_trap_pop ();
@@ -397,7 +1267,7 @@ void my_wnck_delete_property(Window xwindow, Atom atom)
  */
 gboolean
 my_wnck_get_cardinal_list (Window xwindow, Atom atom,
-                           gulong **cardinals, int *len)
+                           gulong **cardinals, int *len, int max_len)
 {
 	Atom type;
 	int format;
@@ -411,10 +1281,11 @@ my_wnck_get_cardinal_list (Window xwindow, Atom atom,
 
 	devilspie2_error_trap_push();
 	type = None;
+	// only fetch as many as the caller can use
 	result = XGetWindowProperty(gdk_x11_get_default_xdisplay (),
 	                            xwindow,
 	                            atom,
-	                            0, G_MAXLONG,
+	                            0, max_len,
 	                            False, XA_CARDINAL, &type, &format, &nitems,
 	                            &bytes_after, (void*)&nums);
 
@@ -438,41 +1309,11 @@ my_wnck_get_cardinal_list (Window xwindow, Atom atom,
 }
 
 
-/**
- *	Get viewport start coordinates to the x and y integers,
- * returns 0 on success and non-zero on error.
- */
-int devilspie2_get_viewport_start(Window xid, int *x, int *y)
-{
-	gulong *list;
-	int len;
-
-	int result = -1;
-
-	my_wnck_get_cardinal_list(RootWindowOfScreen(devilspie2_window_get_xscreen(xid)),
-	                          my_wnck_atom_get("_NET_DESKTOP_VIEWPORT"),
-	                          &list, &len);
-
-	if (len > 0) {
-		*x = list[0];
-		*y = list[1];
-
-		result = 0;
-	}
-
-	g_free(list);
-
-	return result;
-}
-
-
 /**
  *
  */
 void my_window_set_window_type(Window xid, gchar *window_type)
 {
-	Display *display = gdk_x11_get_default_xdisplay();
-
 	Atom atoms[10];
 
 	/*
@@ -518,10 +1359,11 @@ void my_window_set_window_type(Window xid, gchar *window_type)
 		type = g_strdup(window_type);
 	}
 
-	atoms[0] = XInternAtom(display, type, False);
+	atoms[0] = my_wnck_atom_get(type);
 
+	invalidate_window_property(xid, my_wnck_atom_get("_NET_WM_WINDOW_TYPE"));
 	XChangeProperty(gdk_x11_get_default_xdisplay(), xid,
-	                XInternAtom(display, "_NET_WM_WINDOW_TYPE", False), XA_ATOM, 32,
+	                my_wnck_atom_get("_NET_WM_WINDOW_TYPE"), XA_ATOM, 32,
 	                PropModeReplace, (unsigned char *) &atoms, 1);
 
 	g_free(type);
@@ -533,12 +1375,11 @@ void my_window_set_window_type(Window xid, gchar *window_type)
  */
 void my_window_set_opacity(Window xid, double value)
 {
-	Display *display = gdk_x11_get_default_xdisplay();
-
 	unsigned int opacity = (uint)(0xffffffff * value);
-	Atom atom_net_wm_opacity = XInternAtom(display, "_NET_WM_WINDOW_OPACITY", False);
+	Atom atom_net_wm_opacity = my_wnck_atom_get("_NET_WM_WINDOW_OPACITY");
 
 
+	invalidate_window_property(xid, atom_net_wm_opacity);
 	XChangeProperty(gdk_x11_get_default_xdisplay(), xid,
 	                atom_net_wm_opacity, XA_CARDINAL, 32,
 	                PropModeReplace, (unsigned char *) &opacity, 1L);
@@ -564,131 +1405,1023 @@ void adjust_for_decoration(WnckWindow *window, int *x, int *y, int *w, int *h)
 
 
 /**
+ * Changes which the scripts make while an event is being handled are
+ * collected here, per window, and sent once the event has been handled:
+ * one move/resize and one batch of _NET_WM_STATE changes per window,
+ * however many calls the scripts made. Later changes override earlier
+ * ones. Outside events, changes are sent straight away unless a script
+ * has started a layout (begin_layout()), in which case they're collected
+ * until it's committed. Workspace and stacking changes are collected too.
  *
+ * Moves and resizes go either via the window manager (as libwnck sends
+ * them) or directly (as XMoveResizeWindow does). If a script switches
+ * between the two, what has been collected so far is sent first.
  */
-void set_window_geometry(WnckWindow *window, int x, int y, int w, int h, gboolean adjusting_for_decoration)
+#define GEOMETRY_MASK (WNCK_WINDOW_CHANGE_X | WNCK_WINDOW_CHANGE_Y | \
+                       WNCK_WINDOW_CHANGE_WIDTH | WNCK_WINDOW_CHANGE_HEIGHT)
+
+struct state_change {
+	Atom state;
+	gboolean add;
+};
+
+struct pending_changes {
+	WnckWindow *window;  /* NULL if the window has gone away */
+	WnckWindowMoveResizeMask changes;
+	gboolean direct;
+	WnckWindowGravity gravity;
+	int x, y, width, height;
+	GArray *states;      /* struct state_change, one per atom */
+	int workspace;       /* index, or a WORKSPACE_* value */
+	int stacking;        /* 1 to raise, -1 to lower, else 0 */
+};
+
+static GSList *pending_changes = NULL;
+static gboolean collecting_event = FALSE;
+static gboolean collecting_layout = FALSE;
+
+#define collecting_changes (collecting_event || collecting_layout)
+
+
+/**
+ *
+ */
+static void send_window_geometry(struct pending_changes *pending)
 {
-	if (window) {
-		WnckScreen *screen = wnck_window_get_screen(window);
-		int sw = wnck_screen_get_width(screen);
-		int sh = wnck_screen_get_height(screen);
+	Window xid = wnck_window_get_xid(pending->window);
 
-		int gravity = WNCK_WINDOW_GRAVITY_CURRENT;
-		if (x >= 0 && y >= 0)
-			gravity = WNCK_WINDOW_GRAVITY_NORTHWEST;
-		if (x >= 0 && y < 0)
-			gravity = WNCK_WINDOW_GRAVITY_SOUTHWEST;
-		if (x < 0 && y >= 0)
-			gravity = WNCK_WINDOW_GRAVITY_NORTHEAST;
-		if (x < 0 && y < 0)
-			gravity = WNCK_WINDOW_GRAVITY_SOUTHEAST;
-		if (x < 0)
-			x = sw + x;
-		if (y < 0)
-			y = sh + y;
+	if (!pending->changes)
+		return;
 
-		if (adjusting_for_decoration)
-			adjust_for_decoration(window, &x, &y, &w, &h);
+	if (pending->direct) {
+		XWindowChanges values = {
+			.x = pending->x, .y = pending->y,
+			.width = pending->width, .height = pending->height
+		};
+		unsigned int mask = 0;
 
-		wnck_window_set_geometry(window,
-		                         gravity,
-		                         WNCK_WINDOW_CHANGE_X +
-		                         WNCK_WINDOW_CHANGE_Y +
-		                         WNCK_WINDOW_CHANGE_WIDTH +
-		                         WNCK_WINDOW_CHANGE_HEIGHT,
-		                         x, y, w, h);
+		if (pending->changes & WNCK_WINDOW_CHANGE_X)      mask |= CWX;
+		if (pending->changes & WNCK_WINDOW_CHANGE_Y)      mask |= CWY;
+		if (pending->changes & WNCK_WINDOW_CHANGE_WIDTH)  mask |= CWWidth;
+		if (pending->changes & WNCK_WINDOW_CHANGE_HEIGHT) mask |= CWHeight;
+
+		XConfigureWindow(gdk_x11_get_default_xdisplay(), xid, mask, &values);
+	} else {
+		wnck_window_set_geometry(pending->window, pending->gravity, pending->changes,
+		                         pending->x, pending->y, pending->width, pending->height);
 	}
 
+	pending->changes = 0;
 }
 
 
 /**
- *
+ * Sends the state changes which add (or remove) states, two to a message
  */
-int get_monitor_count(void)
+static void send_window_states(struct pending_changes *pending, gboolean add)
 {
-	// FIXME: retrieve monitor count via wnck
-	// For now, use Xinerama directly
-	Display *dpy = gdk_x11_get_default_xdisplay();
+	Window xid = wnck_window_get_xid(pending->window);
+	Screen *screen = NULL;
+	Atom pair = None;
+
+	for (guint i = 0; i < pending->states->len; i++) {
+		struct state_change *change = &g_array_index(pending->states, struct state_change, i);
+
+		if (change->add != add)
+			continue;
+		if (!screen)
+			screen = devilspie2_window_get_xscreen(xid);
+		if (pair == None) {
+			pair = change->state;
+		} else {
+			devilspie2_change_state(screen, xid, add, pair, change->state);
+			pair = None;
+		}
+	}
 
-	if (!XineramaIsActive(dpy))
-		return 0;
+	if (pair != None)
+		devilspie2_change_state(screen, xid, add, pair, None);
+}
 
-	// Normally, we'd use the return value, but we only want the number of entries
-	int monitor_count = 0;
-	XineramaQueryScreens(dpy, &monitor_count);
 
-	return monitor_count;
+/**
+ * A workspace which doesn't exist (any more) is ignored
+ */
+static void send_window_workspace(struct pending_changes *pending)
+{
+	WnckWorkspace *workspace;
+
+	switch (pending->workspace) {
+	case WORKSPACE_NONE:
+		break;
+	case WORKSPACE_PIN:
+		wnck_window_pin(pending->window);
+		break;
+	case WORKSPACE_UNPIN:
+		wnck_window_unpin(pending->window);
+		break;
+	default:
+		workspace = wnck_screen_get_workspace(wnck_window_get_screen(pending->window),
+		                                      pending->workspace);
+		if (workspace)
+			wnck_window_move_to_workspace(pending->window, workspace);
+	}
+
+	pending->workspace = WORKSPACE_NONE;
 }
 
 
 /**
  *
  */
-int get_monitor_index_geometry(WnckWindow *window, const GdkRectangle *window_r_in, GdkRectangle *monitor_r)
+static void send_window_stacking(struct pending_changes *pending)
 {
-	// monitor_r is always filled in unless the return value is -1
+	if (pending->stacking > 0)
+		XRaiseWindow(gdk_x11_get_default_xdisplay(), wnck_window_get_xid(pending->window));
+	else if (pending->stacking < 0)
+		XLowerWindow(gdk_x11_get_default_xdisplay(), wnck_window_get_xid(pending->window));
 
-	// FIXME: retrieve monitor info via wnck
-	// For now, use Xinerama directly
-	int id = -1;
-	int monitor_count = 0;
-	XineramaScreenInfo *monitor_list = NULL;
-	Display *dpy = gdk_x11_get_default_xdisplay();
+	pending->stacking = 0;
+}
 
-	if (XineramaIsActive(dpy))
-		monitor_list = XineramaQueryScreens(dpy, &monitor_count);
 
-	// bail out if no Xinermama or no monitors
-	if (!monitor_list || !monitor_count)
-		return -1;
+/**
+ *
+ */
+static void free_pending_changes(struct pending_changes *pending)
+{
+	if (pending->window)
+		g_object_remove_weak_pointer(G_OBJECT(pending->window), (gpointer *)&pending->window);
+	g_array_free(pending->states, TRUE);
+	g_free(pending);
+}
 
-	// find which monitor the window's centre is on
-	GdkRectangle window_r;
-	if (window)
-		wnck_window_get_geometry(window, &window_r.x, &window_r.y, &window_r.width, &window_r.height);
-	else
-		window_r = *window_r_in;
 
-	GdkPoint centre = { window_r.x + window_r.width / 2, window_r.y + window_r.height / 2 };
+/**
+ *
+ */
+static struct pending_changes *find_pending_changes(WnckWindow *window, gboolean create)
+{
+	for (GSList *item = pending_changes; item; item = item->next)
+		if (((struct pending_changes *)item->data)->window == window)
+			return item->data;
+
+	if (!create)
+		return NULL;
+
+	struct pending_changes *pending = g_new0(struct pending_changes, 1);
+
+	pending->window = window;
+	pending->states = g_array_new(FALSE, FALSE, sizeof(struct state_change));
+	pending->workspace = WORKSPACE_NONE;
+	// a layout may be left open across events, during which windows can close
+	g_object_add_weak_pointer(G_OBJECT(window), (gpointer *)&pending->window);
+	pending_changes = g_slist_append(pending_changes, pending);
+
+	return pending;
+}
+
+
+/**
+ * Sends what has been collected for one window: states being removed
+ * first (so that, for example, a window is unmaximized before
+ * it's moved), then the workspace and geometry, then states being added
+ * (so that a window is given its size before being maximized, and keeps
+ * it when unmaximized), then stacking.
+ */
+static void send_pending_changes(struct pending_changes *pending)
+{
+	if (!pending->window)
+		return;
+
+	send_window_states(pending, FALSE);
+	send_window_workspace(pending);
+	send_window_geometry(pending);
+	send_window_states(pending, TRUE);
+	g_array_set_size(pending->states, 0);
+	send_window_stacking(pending);
+}
+
+
+/**
+ * Sends everything collected, for all windows
+ */
+static void send_window_changes(void)
+{
+	if (!pending_changes)
+		return;
+
+	devilspie2_error_trap_push();
+
+	for (GSList *item = pending_changes; item; item = item->next)
+		send_pending_changes(item->data);
+
+	if (devilspie2_error_trap_pop())
+		g_printerr("%s\n", _("Failed to change window geometry or state"));
+
+	g_slist_free_full(pending_changes, (GDestroyNotify)free_pending_changes);
+	pending_changes = NULL;
+}
+
+
+/**
+ * Sends whatever has been collected for one window now, ahead of an
+ * action which the window manager carries out at once and which has to
+ * see those changes first (as when a window is moved to another
+ * workspace and then activated)
+ */
+void send_window_changes_now(WnckWindow *window)
+{
+	struct pending_changes *pending = find_pending_changes(window, FALSE);
+
+	if (!pending)
+		return;
+
+	devilspie2_error_trap_push();
+	send_pending_changes(pending);
+	if (devilspie2_error_trap_pop())
+		g_printerr("%s\n", _("Failed to change window geometry or state"));
+
+	pending_changes = g_slist_remove(pending_changes, pending);
+	free_pending_changes(pending);
+}
+
+
+/**
+ * Sends a change made while nothing is being collected
+ */
+static void send_immediate_change(void (*send)(struct pending_changes *),
+                                  struct pending_changes *pending)
+{
+	devilspie2_error_trap_push();
+	send(pending);
+	if (devilspie2_error_trap_pop())
+		g_printerr("%s\n", _("Failed to change window geometry or state"));
+}
+
+
+/**
+ * Whether changes are being collected (during an event or a layout)
+ */
+gboolean collecting_window_changes(void)
+{
+	return collecting_changes;
+}
+
+
+/**
+ * Starts collecting changes (at the start of an event)
+ */
+void begin_window_changes(void)
+{
+	collecting_event = TRUE;
+}
+
+
+/**
+ * Sends the changes collected during an event. A layout still open then
+ * is committed along with them.
+ */
+void flush_window_changes(void)
+{
+	collecting_event = FALSE;
+	collecting_layout = FALSE;
+	send_window_changes();
+}
+
+
+/**
+ * Starts collecting changes for begin_layout(), even outside events.
+ * Returns FALSE if a layout is already open.
+ */
+gboolean begin_layout_changes(void)
+{
+	if (collecting_layout)
+		return FALSE;
+
+	collecting_layout = TRUE;
+	return TRUE;
+}
+
+
+/**
+ * Sends everything collected so far, for commit_layout(). Within an event,
+ * collection carries on afterwards. Returns FALSE if no layout is open.
+ */
+gboolean commit_layout_changes(void)
+{
+	if (!collecting_layout)
+		return FALSE;
+
+	collecting_layout = FALSE;
+	send_window_changes();
+	return TRUE;
+}
+
+
+/**
+ * Commits a layout which a script or callback run outside an event has
+ * left open, once it has returned (within an event, the event's end
+ * takes care of it)
+ */
+void finish_layout_changes(void)
+{
+	if (collecting_layout && !collecting_event) {
+		commit_layout_changes();
+		XFlush(gdk_x11_get_default_xdisplay());
+	}
+}
+
+
+/**
+ * Moves and/or resizes a window via the window manager, as
+ * wnck_window_set_geometry does
+ */
+void change_window_geometry(WnckWindow *window, WnckWindowGravity gravity,
+                            WnckWindowMoveResizeMask changes,
+                            int x, int y, int width, int height)
+{
+	struct pending_changes immediate = { .window = window };
+	struct pending_changes *pending = collecting_changes ? find_pending_changes(window, TRUE) : &immediate;
+
+	if (pending->direct)
+		send_window_geometry(pending);
+
+	// the gravity goes with the position
+	if ((changes & (WNCK_WINDOW_CHANGE_X | WNCK_WINDOW_CHANGE_Y)) ||
+	    !(pending->changes & (WNCK_WINDOW_CHANGE_X | WNCK_WINDOW_CHANGE_Y)))
+		pending->gravity = gravity;
+
+	pending->direct = FALSE;
+	pending->changes |= changes & GEOMETRY_MASK;
+	if (changes & WNCK_WINDOW_CHANGE_X)      pending->x = x;
+	if (changes & WNCK_WINDOW_CHANGE_Y)      pending->y = y;
+	if (changes & WNCK_WINDOW_CHANGE_WIDTH)  pending->width = width;
+	if (changes & WNCK_WINDOW_CHANGE_HEIGHT) pending->height = height;
+
+	if (pending == &immediate)
+		send_immediate_change(send_window_geometry, pending);
+}
+
+
+/**
+ * Moves and/or resizes a window directly, as XMoveResizeWindow does
+ */
+void configure_window(WnckWindow *window, WnckWindowMoveResizeMask changes,
+                      int x, int y, int width, int height)
+{
+	struct pending_changes immediate = { .window = window, .direct = TRUE };
+	struct pending_changes *pending = collecting_changes ? find_pending_changes(window, TRUE) : &immediate;
+
+	if (!pending->direct)
+		send_window_geometry(pending);
+
+	pending->direct = TRUE;
+	pending->changes |= changes & GEOMETRY_MASK;
+	if (changes & WNCK_WINDOW_CHANGE_X)      pending->x = x;
+	if (changes & WNCK_WINDOW_CHANGE_Y)      pending->y = y;
+	if (changes & WNCK_WINDOW_CHANGE_WIDTH)  pending->width = width;
+	if (changes & WNCK_WINDOW_CHANGE_HEIGHT) pending->height = height;
+
+	if (pending == &immediate)
+		send_immediate_change(send_window_geometry, pending);
+}
+
+
+/**
+ * Adds or removes one or two _NET_WM_STATE atoms (state2 may be None)
+ */
+void change_window_state(WnckWindow *window, gboolean add, Atom state1, Atom state2)
+{
+	if (!collecting_changes) {
+		Window xid = wnck_window_get_xid(window);
+
+		devilspie2_error_trap_push();
+		devilspie2_change_state(devilspie2_window_get_xscreen(xid), xid, add, state1, state2);
+		if (devilspie2_error_trap_pop())
+			g_printerr("%s\n", _("Failed to change window geometry or state"));
+		return;
+	}
+
+	struct pending_changes *pending = find_pending_changes(window, TRUE);
+	Atom states[2] = { state1, state2 };
+
+	for (int i = 0; i < 2 && states[i] != None; i++) {
+		struct state_change change = { states[i], add };
+		guint j;
+
+		for (j = 0; j < pending->states->len; j++)
+			if (g_array_index(pending->states, struct state_change, j).state == states[i])
+				break;
+
+		if (j < pending->states->len)
+			g_array_index(pending->states, struct state_change, j) = change;
+		else
+			g_array_append_val(pending->states, change);
+	}
+}
+
+
+/**
+ * Moves a window to a workspace (by index, from 0) or pins or unpins it
+ */
+void change_window_workspace(WnckWindow *window, int workspace)
+{
+	struct pending_changes immediate = { .window = window };
+	struct pending_changes *pending = collecting_changes ? find_pending_changes(window, TRUE) : &immediate;
+
+	pending->workspace = workspace;
+
+	if (pending == &immediate)
+		send_immediate_change(send_window_workspace, pending);
+}
+
+
+/**
+ * Raises (1) or lowers (-1) a window
+ */
+void restack_window(WnckWindow *window, int stacking)
+{
+	struct pending_changes immediate = { .window = window };
+	struct pending_changes *pending = collecting_changes ? find_pending_changes(window, TRUE) : &immediate;
+
+	pending->stacking = stacking;
+
+	if (pending == &immediate)
+		send_immediate_change(send_window_stacking, pending);
+}
+
+
+/**
+ * The workspace which a window will be on as far as the scripts know:
+ * an index, WORKSPACE_PIN, or WORKSPACE_NONE if no change is pending
+ */
+int get_pending_workspace(WnckWindow *window)
+{
+	struct pending_changes *pending = find_pending_changes(window, FALSE);
+
+	return pending ? pending->workspace : WORKSPACE_NONE;
+}
+
+
+/**
+ * As wnck_window_get_geometry, but including any changes not yet sent
+ */
+void get_window_geometry(WnckWindow *window, int *x, int *y, int *width, int *height)
+{
+	struct pending_changes *pending = find_pending_changes(window, FALSE);
+
+	wnck_window_get_geometry(window, x, y, width, height);
+
+	if (pending) {
+		if (pending->changes & WNCK_WINDOW_CHANGE_X)      *x = pending->x;
+		if (pending->changes & WNCK_WINDOW_CHANGE_Y)      *y = pending->y;
+		if (pending->changes & WNCK_WINDOW_CHANGE_WIDTH)  *width = pending->width;
+		if (pending->changes & WNCK_WINDOW_CHANGE_HEIGHT) *height = pending->height;
+	}
+}
+
+
+/**
+ * Whether a _NET_WM_STATE atom is set, as far as the scripts know: TRUE
+ * or FALSE if it's been changed but not yet sent, else current
+ */
+gboolean get_window_state(WnckWindow *window, Atom state, gboolean current)
+{
+	struct pending_changes *pending = find_pending_changes(window, FALSE);
+
+	if (pending) {
+		for (guint i = 0; i < pending->states->len; i++) {
+			struct state_change *change = &g_array_index(pending->states, struct state_change, i);
+			if (change->state == state)
+				return change->add;
+		}
+	}
+
+	return current;
+}
+
+
+/**
+ *
+ */
+void set_window_geometry(WnckWindow *window, int x, int y, int w, int h, gboolean adjusting_for_decoration)
+{
+	if (window) {
+		WnckScreen *screen = wnck_window_get_screen(window);
+		int sw = wnck_screen_get_width(screen);
+		int sh = wnck_screen_get_height(screen);
+
+		int gravity = WNCK_WINDOW_GRAVITY_CURRENT;
+		if (x >= 0 && y >= 0)
+			gravity = WNCK_WINDOW_GRAVITY_NORTHWEST;
+		if (x >= 0 && y < 0)
+			gravity = WNCK_WINDOW_GRAVITY_SOUTHWEST;
+		if (x < 0 && y >= 0)
+			gravity = WNCK_WINDOW_GRAVITY_NORTHEAST;
+		if (x < 0 && y < 0)
+			gravity = WNCK_WINDOW_GRAVITY_SOUTHEAST;
+		if (x < 0)
+			x = sw + x;
+		if (y < 0)
+			y = sh + y;
+
+		if (adjusting_for_decoration)
+			adjust_for_decoration(window, &x, &y, &w, &h);
+
+		change_window_geometry(window,
+		                       gravity,
+		                       WNCK_WINDOW_CHANGE_X +
+		                       WNCK_WINDOW_CHANGE_Y +
+		                       WNCK_WINDOW_CHANGE_WIDTH +
+		                       WNCK_WINDOW_CHANGE_HEIGHT,
+		                       x, y, w, h);
+	}
+
+}
+
+
+/**
+ * The monitor layout, as reported by Xinerama (whose order gives the
+ * monitor numbers which scripts use). It's refreshed only when RandR says
+ * that the layout has changed; without RandR, it's re-read on each use.
+ *
+ * For layouts with many monitors (video walls), the bounding box is split
+ * into a grid of cells, each listing the monitors which overlap it, so
+ * that finding a window's monitor needn't look at every one.
+ */
+#define MONITOR_GRID_MAX 64
+
+static struct {
+	gboolean valid;
+	int count;
+	int primary;
+	GdkRectangle *rects;
+	GdkRectangle bounds;
+	int cell_w, cell_h, cols, rows;
+	guint serial; /* bumped whenever RandR reports a change */
+	GSList **cells;
+	guint *seen;
+	guint generation;
+} monitors;
+
+/**
+ * Values read from the (default screen's) root window, kept until a
+ * PropertyNotify or RandR event says that they've changed
+ */
+static struct {
+	gboolean viewport_valid;
+	int viewport_result, viewport_x, viewport_y;
+	gboolean desktop_size_valid;
+	int desktop_width, desktop_height;
+	gboolean max_size_valid;
+	int max_width, max_height;
+	GHashTable *workspace_index;
+} root_state;
+
+static gboolean watching_root = FALSE;
+#ifdef HAVE_XRANDR
+static int randr_event_base = 0;
+#endif
+
+
+/**
+ *
+ */
+static GdkFilterReturn root_event_filter(GdkXEvent *gdk_xevent,
+                                         GdkEvent *event G_GNUC_UNUSED,
+                                         gpointer data G_GNUC_UNUSED)
+{
+	XEvent *xevent = (XEvent *)gdk_xevent;
+
+	if (xevent->type == PropertyNotify && property_cache)
+		invalidate_window_property(xevent->xproperty.window, xevent->xproperty.atom);
+
+	if (xevent->type == PropertyNotify &&
+	    xevent->xproperty.window == DefaultRootWindow(xevent->xproperty.display)) {
+		Atom atom = xevent->xproperty.atom;
+
+		if (atom == my_wnck_atom_get("_NET_DESKTOP_VIEWPORT")) {
+			root_state.viewport_valid = FALSE;
+		} else if (atom == my_wnck_atom_get("_NET_DESKTOP_GEOMETRY")) {
+			root_state.desktop_size_valid = FALSE;
+		} else if (atom == my_wnck_atom_get("_NET_DESKTOP_NAMES") ||
+		           atom == my_wnck_atom_get("_NET_NUMBER_OF_DESKTOPS")) {
+			if (root_state.workspace_index)
+				g_hash_table_destroy(root_state.workspace_index);
+			root_state.workspace_index = NULL;
+		}
+	}
+
+	return GDK_FILTER_CONTINUE;
+}
+
+
+#ifdef HAVE_XRANDR
+/**
+ * GDK follows RandR on our behalf and says when the layout changes
+ */
+static void monitors_changed_cb(GdkScreen *screen G_GNUC_UNUSED,
+                                gpointer data G_GNUC_UNUSED)
+{
+	monitors.valid = FALSE;
+	monitors.serial++;
+	root_state.max_size_valid = FALSE;
+}
+#endif
+
+
+/**
+ * Asks for the root window property change notifications, and GDK's
+ * monitor layout change signals, on which the cached root window state
+ * and monitor layout depend
+ */
+static void watch_root_window(Display *dpy)
+{
+	XWindowAttributes attrs;
+	Window root = DefaultRootWindow(dpy);
+
+	if (watching_root)
+		return;
+	watching_root = TRUE;
+
+	// keep whatever GDK and libwnck have already asked for
+	XGetWindowAttributes(dpy, root, &attrs);
+	XSelectInput(dpy, root, attrs.your_event_mask | PropertyChangeMask);
+
+#ifdef HAVE_XRANDR
+	int error_base;
+
+	// GDK already has RandR notifications selected, and selecting them
+	// ourselves would replace its choice
+	if (XRRQueryExtension(dpy, &randr_event_base, &error_base)) {
+		g_signal_connect(gdk_screen_get_default(), "monitors-changed",
+		                 G_CALLBACK(monitors_changed_cb), NULL);
+		g_signal_connect(gdk_screen_get_default(), "size-changed",
+		                 G_CALLBACK(monitors_changed_cb), NULL);
+	} else {
+		randr_event_base = 0;
+	}
+#endif
+
+	gdk_window_add_filter(NULL, root_event_filter, NULL);
+}
+
 
+
+/**
+ * Starts caching a window's properties, asking to be told when they change
+ */
+void watch_window_properties(Window xid)
+{
+	Display *dpy = gdk_x11_get_default_xdisplay();
+	XWindowAttributes attrs;
+
+	if (get_window_properties(xid))
+		return;
+
+	watch_root_window(dpy);
+
+	// keep whatever libwnck has already asked for
+	devilspie2_error_trap_push();
+	XGetWindowAttributes(dpy, xid, &attrs);
+	XSelectInput(dpy, xid, attrs.your_event_mask | PropertyChangeMask);
+	if (devilspie2_error_trap_pop())
+		return;
+
+	if (!property_cache)
+		property_cache = g_hash_table_new_full(NULL, NULL, NULL, free_window_properties);
+
+	struct window_properties *props = g_new(struct window_properties, 1);
+	props->strings = g_hash_table_new_full(NULL, NULL, NULL, free_cached_property);
+	props->decorated = -1;
+	g_hash_table_insert(property_cache, GSIZE_TO_POINTER(xid), props);
+}
+
+/**
+ * Asks to be told when the window is mapped (if we aren't already);
+ * returns whether it's mapped now
+ */
+gboolean watch_window_mapping(Window xid)
+{
+	Display *dpy = gdk_x11_get_default_xdisplay();
+	XWindowAttributes attrs;
+	Status ok;
+
+	devilspie2_error_trap_push();
+	ok = XGetWindowAttributes(dpy, xid, &attrs);
+	if (ok && !(attrs.your_event_mask & StructureNotifyMask)) {
+		// keep whatever libwnck and we have already asked for
+		XSelectInput(dpy, xid, attrs.your_event_mask | StructureNotifyMask);
+		// it may have been mapped in between
+		ok = XGetWindowAttributes(dpy, xid, &attrs);
+	}
+	if (devilspie2_error_trap_pop() || !ok)
+		return FALSE;
+
+	return attrs.map_state != IsUnmapped;
+}
+
+#ifdef HAVE_XRANDR
+/**
+ * Which of the monitors is the primary one, if RandR (1.5+) can say
+ */
+static int find_primary_monitor(Display *dpy)
+{
+	int major = 0, minor = 0, count = 0, primary = 0;
+	XRRMonitorInfo *info;
+
+	if (!XRRQueryVersion(dpy, &major, &minor) || major < 1 || (major == 1 && minor < 5))
+		return 0;
+
+	info = XRRGetMonitors(dpy, DefaultRootWindow(dpy), True, &count);
+	if (!info)
+		return 0;
+
+	for (int i = 0; i < count; ++i) {
+		if (!info[i].primary)
+			continue;
+		for (int j = 0; j < monitors.count; ++j) {
+			if (monitors.rects[j].x == info[i].x && monitors.rects[j].y == info[i].y &&
+			    monitors.rects[j].width == info[i].width &&
+			    monitors.rects[j].height == info[i].height) {
+				primary = j;
+				break;
+			}
+		}
+		break;
+	}
+
+	XRRFreeMonitors(info);
+	return primary;
+}
+#endif
+
+
+/**
+ *
+ */
+static void clear_monitor_table(void)
+{
+	if (monitors.cells) {
+		for (int i = 0; i < monitors.cols * monitors.rows; ++i)
+			g_slist_free(monitors.cells[i]);
+		g_free(monitors.cells);
+	}
+	g_free(monitors.rects);
+	g_free(monitors.seen);
+
+	monitors.cells = NULL;
+	monitors.rects = NULL;
+	monitors.seen = NULL;
+	monitors.count = 0;
+	monitors.primary = 0;
+}
+
+
+/**
+ *
+ */
+static void build_monitor_grid(void)
+{
+	int min_w = G_MAXINT, min_h = G_MAXINT;
+	int x1 = G_MAXINT, y1 = G_MAXINT, x2 = G_MININT, y2 = G_MININT;
+
+	for (int i = 0; i < monitors.count; ++i) {
+		GdkRectangle *r = &monitors.rects[i];
+		x1 = MIN(x1, r->x);
+		y1 = MIN(y1, r->y);
+		x2 = MAX(x2, r->x + r->width);
+		y2 = MAX(y2, r->y + r->height);
+		min_w = MIN(min_w, MAX(r->width, 1));
+		min_h = MIN(min_h, MAX(r->height, 1));
+	}
+
+	monitors.bounds = (GdkRectangle){ x1, y1, x2 - x1, y2 - y1 };
+
+	// one cell per (smallest) monitor, within reason
+	monitors.cell_w = MAX(min_w, (monitors.bounds.width + MONITOR_GRID_MAX - 1) / MONITOR_GRID_MAX);
+	monitors.cell_h = MAX(min_h, (monitors.bounds.height + MONITOR_GRID_MAX - 1) / MONITOR_GRID_MAX);
+	monitors.cols = (monitors.bounds.width + monitors.cell_w - 1) / monitors.cell_w;
+	monitors.rows = (monitors.bounds.height + monitors.cell_h - 1) / monitors.cell_h;
+	monitors.cells = g_new0(GSList *, monitors.cols * monitors.rows);
+
+	// in reverse so that each cell lists its monitors in index order
+	for (int i = monitors.count - 1; i >= 0; --i) {
+		GdkRectangle *r = &monitors.rects[i];
+		if (r->width <= 0 || r->height <= 0)
+			continue;
+		int c1 = (r->x - x1) / monitors.cell_w;
+		int c2 = (r->x + r->width - 1 - x1) / monitors.cell_w;
+		int r1 = (r->y - y1) / monitors.cell_h;
+		int r2 = (r->y + r->height - 1 - y1) / monitors.cell_h;
+		for (int row = r1; row <= r2; ++row)
+			for (int col = c1; col <= c2; ++col)
+				monitors.cells[row * monitors.cols + col] =
+					g_slist_prepend(monitors.cells[row * monitors.cols + col], GINT_TO_POINTER(i));
+	}
+}
+
+
+/**
+ * Changes whenever the monitor layout is known to have changed, so that
+ * monitor numbers worked out earlier can be checked
+ */
+guint get_monitor_layout_serial(void)
+{
+	return monitors.serial;
+}
+
+
+/**
+ * Makes sure that the monitor table is up to date
+ */
+static gboolean get_monitors(void)
+{
+	Display *dpy = gdk_x11_get_default_xdisplay();
+
+	watch_root_window(dpy);
+
+#ifdef HAVE_XRANDR
+	if (monitors.valid && randr_event_base)
+		return monitors.count > 0;
+#endif
+
+	clear_monitor_table();
+	monitors.valid = TRUE;
+
+	int monitor_count = 0;
+	XineramaScreenInfo *monitor_list = NULL;
+
+	if (XineramaIsActive(dpy))
+		monitor_list = XineramaQueryScreens(dpy, &monitor_count);
+
+	// bail out if no Xinerama or no monitors
+	if (!monitor_list || !monitor_count) {
+		if (monitor_list)
+			XFree(monitor_list);
+		return FALSE;
+	}
+
+	monitors.count = monitor_count;
+	monitors.rects = g_new(GdkRectangle, monitor_count);
+	monitors.seen = g_new0(guint, monitor_count);
 	for (int i = 0; i < monitor_count; ++i) {
-		if (centre.x >= monitor_list[i].x_org &&
-		    centre.x <  monitor_list[i].x_org + monitor_list[i].width &&
-		    centre.y >= monitor_list[i].y_org &&
-		    centre.y <  monitor_list[i].y_org + monitor_list[i].height) {
-			id = i;
-			break;
+		monitors.rects[i].x = monitor_list[i].x_org;
+		monitors.rects[i].y = monitor_list[i].y_org;
+		monitors.rects[i].width = monitor_list[i].width;
+		monitors.rects[i].height = monitor_list[i].height;
+	}
+	XFree(monitor_list);
+
+#ifdef HAVE_XRANDR
+	if (randr_event_base)
+		monitors.primary = find_primary_monitor(dpy);
+#endif
+
+	build_monitor_grid();
+
+	return TRUE;
+}
+
+
+/**
+ * Calls func for each monitor which may overlap rect (each one once)
+ */
+static void foreach_monitor_near(const GdkRectangle *rect,
+                                 void (*func)(int index, gpointer data), gpointer data)
+{
+	int c1 = (rect->x - monitors.bounds.x) / monitors.cell_w;
+	int c2 = (rect->x + MAX(rect->width, 1) - 1 - monitors.bounds.x) / monitors.cell_w;
+	int r1 = (rect->y - monitors.bounds.y) / monitors.cell_h;
+	int r2 = (rect->y + MAX(rect->height, 1) - 1 - monitors.bounds.y) / monitors.cell_h;
+
+	c1 = CLAMP(c1, 0, monitors.cols - 1);
+	c2 = CLAMP(c2, 0, monitors.cols - 1);
+	r1 = CLAMP(r1, 0, monitors.rows - 1);
+	r2 = CLAMP(r2, 0, monitors.rows - 1);
+
+	if (++monitors.generation == 0) {
+		memset(monitors.seen, 0, monitors.count * sizeof(*monitors.seen));
+		monitors.generation = 1;
+	}
+
+	for (int row = r1; row <= r2; ++row) {
+		for (int col = c1; col <= c2; ++col) {
+			for (GSList *l = monitors.cells[row * monitors.cols + col]; l; l = l->next) {
+				int i = GPOINTER_TO_INT(l->data);
+				if (monitors.seen[i] != monitors.generation) {
+					monitors.seen[i] = monitors.generation;
+					func(i, data);
+				}
+			}
 		}
 	}
+}
+
+
+struct overlap_search {
+	GdkRectangle window_r;
+	GdkPoint centre;
+	int id;
+	gint64 area;
+	gint64 distance;
+};
+
+
+/**
+ * Keeps whichever monitor shows most of the window; if tied, whichever is
+ * centred closest to the window's centre; if still tied, the lowest index
+ */
+static void check_monitor_overlap(int i, gpointer data)
+{
+	struct overlap_search *search = data;
+	GdkRectangle overlap;
+
+	if (!gdk_rectangle_intersect(&search->window_r, &monitors.rects[i], &overlap))
+		return;
+
+	gint64 area = (gint64)overlap.width * overlap.height;
+	gint64 dx = monitors.rects[i].x + monitors.rects[i].width / 2 - search->centre.x;
+	gint64 dy = monitors.rects[i].y + monitors.rects[i].height / 2 - search->centre.y;
+	gint64 distance = dx * dx + dy * dy;
+
+	if (area > search->area ||
+	    (area == search->area &&
+	     (distance < search->distance || (distance == search->distance && i < search->id)))) {
+		search->id = i;
+		search->area = area;
+		search->distance = distance;
+	}
+}
 
-	// if that fails, try intersection of rectangles
-	// just use the first matching
-	// FIXME?: should find whichever shows most of the window (if tied, closest to window centre)
-	if (id < 0) {
-		for (int i = 0; i < monitor_count; ++i) {
-			GdkRectangle r = {
-				monitor_list[i].x_org, monitor_list[i].y_org,
-				monitor_list[i].x_org + monitor_list[i].width,
-				monitor_list[i].y_org + monitor_list[i].height
-			};
-			if (gdk_rectangle_intersect(&window_r, &r, NULL)) {
-				id = i;
+
+/**
+ *
+ */
+int get_monitor_count(void)
+{
+	// FIXME: retrieve monitor count via wnck
+	// For now, use Xinerama directly
+	if (!get_monitors())
+		return 0;
+
+	return monitors.count;
+}
+
+
+/**
+ *
+ */
+int get_monitor_index_geometry(WnckWindow *window, const GdkRectangle *window_r_in, GdkRectangle *monitor_r)
+{
+	// monitor_r is always filled in unless the return value is -1
+
+	// FIXME: retrieve monitor info via wnck
+	// For now, use Xinerama directly
+	int id = -1;
+
+	// bail out if no Xinerama or no monitors
+	if (!get_monitors())
+		return -1;
+
+	// find which monitor the window's centre is on
+	GdkRectangle window_r;
+	if (window)
+		wnck_window_get_geometry(window, &window_r.x, &window_r.y, &window_r.width, &window_r.height);
+	else
+		window_r = *window_r_in;
+
+	GdkPoint centre = { window_r.x + window_r.width / 2, window_r.y + window_r.height / 2 };
+
+	if (centre.x >= monitors.bounds.x && centre.x < monitors.bounds.x + monitors.bounds.width &&
+	    centre.y >= monitors.bounds.y && centre.y < monitors.bounds.y + monitors.bounds.height) {
+		int col = (centre.x - monitors.bounds.x) / monitors.cell_w;
+		int row = (centre.y - monitors.bounds.y) / monitors.cell_h;
+
+		for (GSList *l = monitors.cells[row * monitors.cols + col]; l; l = l->next) {
+			GdkRectangle *r = &monitors.rects[GPOINTER_TO_INT(l->data)];
+			if (centre.x >= r->x && centre.x < r->x + r->width &&
+			    centre.y >= r->y && centre.y < r->y + r->height) {
+				id = GPOINTER_TO_INT(l->data);
 				break;
 			}
 		}
 	}
 
-	// and if that too fails, use the default
+	// if that fails, use whichever shows most of the window
+	if (id < 0) {
+		struct overlap_search search = { window_r, centre, -1, 0, 0 };
+		foreach_monitor_near(&window_r, check_monitor_overlap, &search);
+		id = search.id;
+	}
+
+	// and if that too fails, use the primary monitor
 	if (id < 0)
-		id = 0; // FIXME: primary monitor
+		id = monitors.primary;
 
-	if (monitor_r) {
-		monitor_r->x = monitor_list[id].x_org;
-		monitor_r->y = monitor_list[id].y_org;
-		monitor_r->width = monitor_list[id].width;
-		monitor_r->height = monitor_list[id].height;
-	}
+	if (monitor_r)
+		*monitor_r = monitors.rects[id];
 
 	return id;
 }
@@ -699,41 +2432,198 @@ int get_monitor_index_geometry(WnckWindow *window, const GdkRectangle *window_r_
  */
 int get_monitor_geometry(int index, GdkRectangle *monitor_r)
 {
-	// if out of range, output is for monitor 0 (if present) else this:
+	// if out of range, output is for the primary monitor (if present) else this:
 	*monitor_r = (GdkRectangle){ 0, 0, 640, 480 };
 
 	// FIXME: retrieve monitor info via wnck
 	// For now, use Xinerama directly
-	int monitor_count = 0;
-	XineramaScreenInfo *monitor_list = NULL;
-	Display *dpy = gdk_x11_get_default_xdisplay();
-
-	if (XineramaIsActive(dpy))
-		monitor_list = XineramaQueryScreens(dpy, &monitor_count);
 
-	// bail out if no Xinermama or no monitors
-	if (!monitor_list || !monitor_count)
+	// bail out if no Xinerama or no monitors
+	if (!get_monitors())
 		return -1; // no xinerama!
 
-	// FIXME: default to primary monitor
-	if (index < 0 || index >= monitor_count)
-		index = 0;
+	if (index < 0 || index >= monitors.count)
+		index = monitors.primary;
 
-	monitor_r->x = monitor_list[index].x_org;
-	monitor_r->y = monitor_list[index].y_org;
-	monitor_r->width = monitor_list[index].width;
-	monitor_r->height = monitor_list[index].height;
+	*monitor_r = monitors.rects[index];
 
 	return index;
 }
 
 
+/**
+ *	Get viewport start coordinates to the x and y integers,
+ * returns 0 on success and non-zero on error.
+ */
+int devilspie2_get_viewport_start(Window xid, int *x, int *y)
+{
+	Display *dpy = gdk_x11_get_default_xdisplay();
+	gulong *list = NULL;
+	int len = 0;
+
+	// the default screen's viewport is cached; the root window tells us if it changes
+	gboolean cached = ScreenCount(dpy) == 1 ||
+	                  RootWindowOfScreen(devilspie2_window_get_xscreen(xid)) == DefaultRootWindow(dpy);
+
+	if (cached) {
+		watch_root_window(dpy);
+		if (root_state.viewport_valid) {
+			*x = root_state.viewport_x;
+			*y = root_state.viewport_y;
+			return root_state.viewport_result;
+		}
+	}
+
+	int result = -1;
+
+	my_wnck_get_cardinal_list(cached ? DefaultRootWindow(dpy)
+	                                 : RootWindowOfScreen(devilspie2_window_get_xscreen(xid)),
+	                          my_wnck_atom_get("_NET_DESKTOP_VIEWPORT"),
+	                          &list, &len, 2);
+
+	if (len > 0) {
+		*x = list[0];
+		*y = list[1];
+
+		result = 0;
+	}
+
+	g_free(list);
+
+	if (cached) {
+		root_state.viewport_valid = TRUE;
+		root_state.viewport_result = result;
+		if (result == 0) {
+			root_state.viewport_x = *x;
+			root_state.viewport_y = *y;
+		}
+	}
+
+	return result;
+}
+
+
+/**
+ * The largest size which the screen can be given, or its current size if
+ * RandR isn't available
+ */
+void get_max_screen_size(int *width, int *height)
+{
+	Display *dpy = gdk_x11_get_default_xdisplay();
+	int screen = DefaultScreen(dpy);
+
+	watch_root_window(dpy);
+
+	if (!root_state.max_size_valid) {
+#ifdef HAVE_XRANDR
+		// If we have xrandr (we probably do), get the maximum screen size
+		int x; // throwaway
+		if (!randr_event_base ||
+		    !XRRGetScreenSizeRange(dpy, RootWindow(dpy, screen), &x, &x,
+		                           &root_state.max_width, &root_state.max_height))
+#endif
+		{
+			// Otherwise, fall back to the current size
+			root_state.max_width = DisplayWidth(dpy, screen);
+			root_state.max_height = DisplayHeight(dpy, screen);
+		}
+#ifdef HAVE_XRANDR
+		// without RandR, the size can change without our knowing
+		root_state.max_size_valid = randr_event_base != 0;
+#endif
+	}
+
+	*width = root_state.max_width;
+	*height = root_state.max_height;
+}
+
+
+/**
+ * Index of the workspace with the given name, according to
+ * _NET_DESKTOP_NAMES; -1 if no workspace is so named there
+ */
+int get_workspace_index_by_name(const gchar *name)
+{
+	Display *dpy = gdk_x11_get_default_xdisplay();
+
+	watch_root_window(dpy);
+
+	if (!root_state.workspace_index) {
+		Atom type;
+		int format;
+		gulong nitems, bytes_after;
+		unsigned char *names = NULL;
+		int err, result;
+
+		root_state.workspace_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+		devilspie2_error_trap_push();
+		result = XGetWindowProperty(dpy, DefaultRootWindow(dpy),
+		                            my_wnck_atom_get("_NET_DESKTOP_NAMES"),
+		                            0, G_MAXLONG, False, my_wnck_atom_get("UTF8_STRING"),
+		                            &type, &format, &nitems, &bytes_after, &names);
+		err = devilspie2_error_trap_pop();
+
+		if (err == Success && result == Success && names) {
+			if (format == 8) {
+				// NUL-separated list; the first of any duplicates wins
+				gulong start = 0;
+				int index = 0;
+				for (gulong i = 0; i < nitems; ++i) {
+					if (names[i] == '\0') {
+						gchar *entry = g_strndup((char *)names + start, i - start);
+						if (!g_hash_table_lookup(root_state.workspace_index, entry))
+							g_hash_table_insert(root_state.workspace_index, entry,
+							                    GINT_TO_POINTER(index + 1));
+						else
+							g_free(entry);
+						start = i + 1;
+						++index;
+					}
+				}
+			}
+			XFree(names);
+		}
+	}
+
+	return GPOINTER_TO_INT(g_hash_table_lookup(root_state.workspace_index, name)) - 1;
+}
+
+
 /**
  *
  */
 int get_window_workspace_geometry(WnckWindow *window, GdkRectangle *geom)
 {
 	WnckScreen *screen = wnck_window_get_screen(window);
+	Display *dpy = gdk_x11_get_default_xdisplay();
+
+	geom->x = 0;
+	geom->y = 0;
+
+	if (wnck_screen_get_number(screen) == DefaultScreen(dpy)) {
+		watch_root_window(dpy);
+
+		if (!root_state.desktop_size_valid) {
+			gulong *size = NULL;
+			int len = 0;
+
+			my_wnck_get_cardinal_list(DefaultRootWindow(dpy),
+			                          my_wnck_atom_get("_NET_DESKTOP_GEOMETRY"),
+			                          &size, &len, 2);
+			root_state.desktop_width = len >= 2 ? (int)size[0] : 0;
+			root_state.desktop_height = len >= 2 ? (int)size[1] : 0;
+			root_state.desktop_size_valid = TRUE;
+			g_free(size);
+		}
+
+		if (root_state.desktop_width > 0 && root_state.desktop_height > 0) {
+			geom->width = root_state.desktop_width;
+			geom->height = root_state.desktop_height;
+			return 0;
+		}
+	}
+
 	WnckWorkspace *workspace = wnck_screen_get_active_workspace(screen);
 
 	if (workspace == NULL) {
@@ -745,8 +2635,6 @@ int get_window_workspace_geometry(WnckWindow *window, GdkRectangle *geom)
 		return 1;
 	}
 
-	geom->x = 0;
-	geom->y = 0;
 	geom->width = wnck_workspace_get_width(workspace);
 	geom->height = wnck_workspace_get_height(workspace);
 
@@ -35,6 +35,8 @@
  *
  */
 Atom my_wnck_atom_get(const char *atom_name);
+const char *my_wnck_atom_name(Atom atom);
+void my_wnck_atom_names(const Atom *atoms, int count, const char **names);
 
 void devilspie2_change_state(Screen *screen,
                              Window xwindow,
@@ -51,7 +53,18 @@ gboolean decorate_window(Window xid);
 gboolean undecorate_window(Window xid);
 gboolean get_decorated(Window xid);
 
+void watch_window_properties(Window xid);
+gboolean watch_window_mapping(Window xid);
+void forget_window_properties(Window xid);
+void invalidate_window_property(Window xid, Atom atom);
+
+void prefetch_client_pids(const Window *xids, int count);
+void forget_client_window(Window xid);
+pid_t get_window_pid(WnckWindow *window);
+
 char* my_wnck_get_string_property(Window xwindow, Atom atom, gboolean *utf8) ATTR_MALLOC;
+void my_wnck_get_string_properties(Window xwindow, const Atom *atoms, int count,
+                                   char **values, gboolean *utf8);
 void my_wnck_set_string_property(Window xwindow, Atom atom, const gchar *const value, gboolean utf8);
 void my_wnck_set_cardinal_property (Window xwindow, Atom atom, int32_t value);
 void my_wnck_delete_property (Window xwindow, Atom atom);
@@ -59,17 +72,49 @@ void my_wnck_delete_property (Window xwindow, Atom atom);
 gboolean my_wnck_get_cardinal_list(Window xwindow,
                                    Atom atom,
                                    gulong **cardinals,
-                                   int *len);
+                                   int *len,
+                                   int max_len);
+unsigned char *my_wnck_get_property_range(Window xwindow, Atom atom,
+                                          gulong offset, gulong max_bytes,
+                                          Atom *type, int *format,
+                                          gulong *nitems, gulong *total);
 
 int devilspie2_get_viewport_start(Window xwindow, int *x, int *y);
+void get_max_screen_size(int *width, int *height);
+int get_workspace_index_by_name(const gchar *name);
 
 void my_window_set_window_type(Window xid, gchar *window_type);
 void my_window_set_opacity(Window xid, double value);
 
+/* Special values for change_window_workspace */
+#define WORKSPACE_NONE  -1
+#define WORKSPACE_PIN   -2
+#define WORKSPACE_UNPIN -3
+
+void begin_window_changes(void);
+void flush_window_changes(void);
+gboolean collecting_window_changes(void);
+gboolean begin_layout_changes(void);
+gboolean commit_layout_changes(void);
+void finish_layout_changes(void);
+void send_window_changes_now(WnckWindow *window);
+void change_window_geometry(WnckWindow *window, WnckWindowGravity gravity,
+                            WnckWindowMoveResizeMask changes,
+                            int x, int y, int width, int height);
+void configure_window(WnckWindow *window, WnckWindowMoveResizeMask changes,
+                      int x, int y, int width, int height);
+void change_window_state(WnckWindow *window, gboolean add, Atom state1, Atom state2);
+void change_window_workspace(WnckWindow *window, int workspace);
+void restack_window(WnckWindow *window, int stacking);
+int get_pending_workspace(WnckWindow *window);
+void get_window_geometry(WnckWindow *window, int *x, int *y, int *width, int *height);
+gboolean get_window_state(WnckWindow *window, Atom state, gboolean current);
+
 void adjust_for_decoration(WnckWindow *window, int *x, int *y, int *w, int *h);
 void set_window_geometry(WnckWindow *window, int x, int y, int w, int h, gboolean adjust_for_decoration);
 
 int get_monitor_count(void);
+guint get_monitor_layout_serial(void);
 int get_monitor_index_geometry(WnckWindow *window, const GdkRectangle *window_r, /*out*/ GdkRectangle *monitor_r);
 int get_monitor_geometry(int index, /*out*/ GdkRectangle *monitor_r);
 